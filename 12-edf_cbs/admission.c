@@ -0,0 +1,302 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Admission control.
+ * create_task() calls admission_test() before a new task becomes valid:
+ * the task is accepted only if the taskset is still schedulable with it.
+ * 
+ * select_best_task() (see sched.c) always runs the dynamic priority tasks
+ * (EDF tasks and CBS servers) before the fixed priority ones, so:
+ *   - the dynamic tasks are analysed alone, with the processor demand
+ *     criterion for EDF. A CBS server is a task with WCET equal to its
+ *     budget and deadline equal to its period, because it never runs for
+ *     more than its budget before its deadline is postponed;
+ *   - each FPR task is interfered by all the dynamic tasks and by the FPR
+ *     tasks of higher or equal priority level (tasks of the same level run
+ *     in FIFO order). Its worst case response time must not exceed its
+ *     period: FPR tasks have implicit deadlines. If there are no dynamic
+ *     tasks and the priorities follow Rate Monotonic, the Liu & Layland
+ *     utilization bound accepts the taskset without any iteration.
+ * 
+ * Only integer arithmetic is used: utilizations are fixed point numbers
+ * with UTIL_SHIFT fractional bits, times are in ticks. Every iterative
+ * test gives up after ADMISSION_MAX_STEPS steps and rejects the task, so
+ * the cost of an admission is bounded even for tasksets whose analysis
+ * would have to look at a whole hyperperiod.
+ * 
+ * The analysis assumes that the WCETs include the overhead of the IRQs
+ * and of the scheduler and that tasks do not block each other. */
+
+#define UTIL_SHIFT 16
+#define UTIL_ONE (1ull << UTIL_SHIFT)
+#define ADMISSION_MAX_STEPS 256
+
+/* Liu & Layland bound n * (2^(1/n) - 1) for n = 1 .. MAX_NUM_TASKS,
+ * rounded down */
+static const u32 ll_bound[MAX_NUM_TASKS] = {
+	65536, 54291, 51102, 49599, 48725, 48154, 47751, 47452,
+	47221, 47037, 46887, 46763, 46658, 46569, 46492, 46424,
+	46364, 46312, 46264, 46222, 46184, 46149, 46117, 46088,
+	46061, 46037, 46014, 45993, 45973, 45954, 45937, 45921,
+};
+
+/* Parameters of a task as seen by the analysis */
+struct adm_task {
+	u32 wcet;
+	u32 period;
+	u32 deadline;   /* Relative deadline, not greater than the period */
+	int level;      /* FPR priority level or -1 for a dynamic task */
+};
+
+/* create_task() holds the scheduler lock, so there's a single admission
+ * at a time and these can be static instead of filling a task stack */
+static struct adm_task adm[MAX_NUM_TASKS];
+static int adm_num;
+
+static inline u32 div32(u32 n, u32 d)
+{
+	unsigned long long q = n;
+	
+	udiv64(&q, d);
+	return (u32) q;
+}
+
+static inline u32 div32_ceil(u32 n, u32 d)
+{
+	unsigned long long q = n;
+	
+	if (udiv64(&q, d))
+		++q;
+	return (u32) q;
+}
+
+/* Utilization of a task, rounded down and up */
+static void utilization(const struct adm_task *a, unsigned long long *floor,
+		unsigned long long *ceil)
+{
+	unsigned long long q = (unsigned long long) a->wcet << UTIL_SHIFT;
+	
+	*ceil += udiv64(&q, a->period) ? q + 1 : q;
+	*floor += q;
+}
+
+/* Copy the parameters of the valid tasks and of the new task t */
+static void adm_collect(struct task *t)
+{
+	struct task *f;
+	struct adm_task *a;
+	
+	adm_num = 0;
+	for (f = taskset + 1; f < taskset + MAX_NUM_TASKS; ++f) { /* Task 0 is the idle task */
+		if (!f->valid && f != t)
+			continue;
+		a = &adm[adm_num++];
+		a->wcet = f->wcet;
+		a->period = f->period;
+		if (f->budget) { /* CBS server */
+			a->deadline = f->period;
+			a->level = -1;
+		}
+		else if (f->rel_deadline) { /* EDF */
+			a->deadline = f->rel_deadline;
+			a->level = -1;
+		}
+		else { /* FPR */
+			a->deadline = f->period;
+			a->level = fpr_level(f);
+		}
+	}
+}
+
+/* Processor demand of the dynamic tasks in [0, t]: execution time of the
+ * jobs released from the critical instant 0 with deadline not after t */
+static unsigned long long edf_demand(u32 t)
+{
+	unsigned long long h = 0;
+	const struct adm_task *a;
+	
+	for (a = adm; a < adm + adm_num; ++a)
+		if (a->level < 0 && a->deadline <= t)
+			h += (unsigned long long)(div32(t - a->deadline, a->period) + 1) * a->wcet;
+	return h;
+}
+
+/* Latest absolute deadline of a dynamic job before t, or 0 if none */
+static u32 edf_prev_deadline(u32 t)
+{
+	const struct adm_task *a;
+	u32 d, max = 0;
+	
+	for (a = adm; a < adm + adm_num; ++a) {
+		if (a->level >= 0 || a->deadline >= t)
+			continue;
+		d = div32(t - a->deadline - 1, a->period) * a->period + a->deadline;
+		if (d > max)
+			max = d;
+	}
+	return max;
+}
+
+/* Length of the synchronous busy period of the dynamic tasks, or 0 if it
+ * cannot be found in ADMISSION_MAX_STEPS steps.
+ * It's the smallest fixed point of w = sum(ceil(w / T) * C). */
+static u32 busy_period(void)
+{
+	const struct adm_task *a;
+	unsigned long long w = 0;
+	u32 busy;
+	int steps;
+	
+	for (a = adm; a < adm + adm_num; ++a)
+		if (a->level < 0)
+			w += a->wcet;
+	for (steps = 0; steps < ADMISSION_MAX_STEPS; ++steps) {
+		if (w > MAXUINT)
+			return 0;
+		busy = (u32) w;
+		w = 0;
+		for (a = adm; a < adm + adm_num; ++a)
+			if (a->level < 0)
+				w += (unsigned long long) div32_ceil(busy, a->period) * a->wcet;
+		if (w == busy)
+			return busy;
+	}
+	return 0;
+}
+
+/* EDF test of the dynamic tasks. Returns 0 if they are schedulable. */
+static int edf_test(void)
+{
+	const struct adm_task *a;
+	unsigned long long u_floor = 0, u_ceil = 0, h;
+	u32 t, dmin = MAXUINT;
+	int implicit = 1, steps;
+	
+	for (a = adm; a < adm + adm_num; ++a) {
+		if (a->level >= 0)
+			continue;
+		utilization(a, &u_floor, &u_ceil);
+		if (a->deadline != a->period)
+			implicit = 0;
+		if (a->deadline < dmin)
+			dmin = a->deadline;
+	}
+	if (dmin == MAXUINT)
+		return 0; /* No dynamic tasks */
+	if (u_floor > UTIL_ONE)
+		return -1; /* U > 1 */
+	if (implicit && u_ceil <= UTIL_ONE)
+		return 0; /* With implicit deadlines U <= 1 is enough */
+	
+	/* Constrained deadlines: the demand must not exceed the length of any
+	 * interval. Only the absolute deadlines inside the first busy period
+	 * must be checked, and Quick Processor-demand Analysis (Zhang and
+	 * Burns) jumps backwards from one of them to the next that matters. */
+	t = busy_period();
+	if (t == 0)
+		return -1; /* Too long to check */
+	t = edf_prev_deadline(t);
+	for (steps = 0; steps < ADMISSION_MAX_STEPS; ++steps) {
+		h = edf_demand(t);
+		if (h > t)
+			return -1; /* Deadline miss at t */
+		if (h <= dmin)
+			return 0;
+		t = (h < t) ? (u32) h : edf_prev_deadline(t);
+	}
+	return -1;
+}
+
+/* The FPR tasks have Rate Monotonic priorities: a shorter period never
+ * has a lower or equal priority level */
+static int rate_monotonic(void)
+{
+	const struct adm_task *a, *b;
+	
+	for (a = adm; a < adm + adm_num; ++a)
+		for (b = adm; b < adm + adm_num; ++b)
+			if (a->level >= 0 && b->level >= 0 &&
+					a->period < b->period && a->level >= b->level)
+				return 0;
+	return 1;
+}
+
+/* Response time analysis of the FPR task a. Returns 0 if its worst case
+ * response time is not greater than its deadline. */
+static int fpr_response_time(const struct adm_task *a)
+{
+	const struct adm_task *b;
+	unsigned long long w;
+	u32 r = a->wcet;
+	int steps;
+	
+	for (steps = 0; steps < ADMISSION_MAX_STEPS; ++steps) {
+		w = a->wcet;
+		for (b = adm; b < adm + adm_num; ++b)
+			if (b != a && (b->level < 0 || b->level <= a->level))
+				w += (unsigned long long) div32_ceil(r, b->period) * b->wcet;
+		if (w > a->deadline)
+			return -1;
+		if (w == r)
+			return 0;
+		r = (u32) w;
+	}
+	return -1;
+}
+
+/* Returns 0 if the valid tasks plus t are schedulable, -1 otherwise.
+ * All the fields of t must be set, except valid. */
+int admission_test(struct task *t)
+{
+	const struct adm_task *a;
+	unsigned long long u_floor = 0, u_ceil = 0;
+	unsigned long long fpr_floor = 0, fpr_ceil = 0;
+	int dynamic = 0, nfpr = 0;
+	
+	adm_collect(t);
+	
+	for (a = adm; a < adm + adm_num; ++a) {
+		utilization(a, &u_floor, &u_ceil);
+		if (a->level < 0) {
+			dynamic = 1;
+		}
+		else {
+			utilization(a, &fpr_floor, &fpr_ceil);
+			++nfpr;
+		}
+	}
+	if (u_floor > UTIL_ONE)
+		return -1; /* Total utilization greater than 1 */
+	
+	/* A new FPR task does not change the schedule of the dynamic ones */
+	if (t->rel_deadline != 0 && edf_test())
+		return -1;
+	
+	if (nfpr == 0)
+		return 0;
+	if (!dynamic && rate_monotonic() && fpr_ceil <= ll_bound[nfpr - 1])
+		return 0;
+	
+	/* Every FPR task, because the new one may interfere with all of them */
+	for (a = adm; a < adm + adm_num; ++a)
+		if (a->level >= 0 && fpr_response_time(a))
+			return -1;
+	return 0;
+}
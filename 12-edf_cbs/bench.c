@@ -0,0 +1,758 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Benchmarks are compiled only with "make benchmark" (or "make
+ * qemu_benchmark", see qemu_bench.sh).
+ * run_benchmarks() is called by entry() before the tasks of the program
+ * are created, then the program continues as usual.
+ * 
+ * Every result is a line of key=value pairs that begins with "@bench",
+ * so that scripts can extract it from the console output:
+ * 
+ *     @bench name=<benchmark> [variant=<v>] [<parameter>=<value>...] n=<runs> min=<> avg=<> max=<> unit=<>
+ * 
+ * Times are measured with read_cycle_counter(): core cycles on the
+ * Raspberry, microseconds of virtual time under QEMU. The lines
+ * "@bench begin" and "@bench end" enclose all the results. */
+
+#ifdef BENCHMARK
+
+#define BENCH_RUNS 64
+
+#ifdef QEMU
+#define BENCH_UNIT "us"
+#else
+#define BENCH_UNIT "cycles"
+#endif
+
+volatile u32 bench_tick_stamp; /* Written by isr_tick() when it begins... */
+volatile u32 bench_tick_end;   /* ...and when it ends */
+
+/* Statistics of a set of measurements */
+struct bench_stat {
+	u32 n;
+	u32 min;
+	u32 max;
+	unsigned long long total;
+};
+
+static void bench_stat_init(struct bench_stat *s)
+{
+	s->n = 0;
+	s->min = MAXUINT;
+	s->max = 0;
+	s->total = 0;
+}
+
+static void bench_stat_add(struct bench_stat *s, u32 c)
+{
+	s->n++;
+	s->total += c;
+	if (c < s->min)
+		s->min = c;
+	if (c > s->max)
+		s->max = c;
+}
+
+/* Begin a result line. variant can be NULL. */
+static void bench_line(const char *name, const char *variant)
+{
+	puts("@bench name=");
+	puts(name);
+	if (variant) {
+		puts(" variant=");
+		puts(variant);
+	}
+}
+
+static void bench_param(const char *key, unsigned long value)
+{
+	puts(" ");
+	puts(key);
+	puts("=");
+	putu(value);
+}
+
+/* End a result line with the statistics */
+static void bench_result(const struct bench_stat *s)
+{
+	unsigned long long avg = s->total;
+	
+	if (s->n)
+		udiv64(&avg, s->n);
+	bench_param("n", s->n);
+	bench_param("min", s->n ? s->min : 0);
+	bench_param("avg", (unsigned long) avg);
+	bench_param("max", s->max);
+	puts(" unit=" BENCH_UNIT "\n");
+}
+
+/* Cost of a call to schedule() that does not change the running task */
+static void bench_schedule(const char *variant)
+{
+	struct bench_stat s;
+	u32 start;
+	int i;
+	
+	bench_stat_init(&s);
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		start = read_cycle_counter();
+		schedule();
+		bench_stat_add(&s, read_cycle_counter() - start);
+	}
+	bench_line("schedule", variant);
+	bench_result(&s);
+}
+
+/* Wait for the next tick with IRQs disabled: the IRQ line gets asserted,
+ * but the CPU cannot serve it yet. Returns with IRQs disabled. */
+static void bench_wait_tick(void)
+{
+	irq_disable();
+	while (!tick_pending());
+}
+
+/* The tick interrupt, measured from the moment the CPU is allowed to take
+ * it (the line is already asserted):
+ *   - irq_entry: until the first instruction of isr_tick(). This includes
+ *     the exception entry, _irq_handler and the dispatch in _bsp_irq()
+ *     ("make fiq_tick_benchmark": _fiq_handler and _bsp_fiq());
+ *   - tick_isr: the body of isr_tick(), i.e. the releases;
+ *   - irq_round_trip: until the interrupted code runs again. */
+static void bench_tick(const char *variant)
+{
+	struct bench_stat entry, isr, round_trip;
+	u32 start, end;
+	int i;
+	
+	bench_stat_init(&entry);
+	bench_stat_init(&isr);
+	bench_stat_init(&round_trip);
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		bench_wait_tick();
+		bench_tick_stamp = 0;
+		start = read_cycle_counter();
+		irq_enable(); /* The interrupt is taken here */
+		end = read_cycle_counter();
+		while (bench_tick_stamp == 0);
+		bench_stat_add(&entry, bench_tick_stamp - start);
+		bench_stat_add(&isr, bench_tick_end - bench_tick_stamp);
+		bench_stat_add(&round_trip, end - start);
+	}
+	bench_line("irq_entry", variant);
+	bench_result(&entry);
+	bench_line("tick_isr", variant);
+	bench_result(&isr);
+	bench_line("irq_round_trip", variant);
+	bench_result(&round_trip);
+}
+
+/* A real task with the highest priority, released by hand by the next
+ * benchmarks. Its period is so long that the timer never releases it. */
+#define BENCH_TASK_NEVER 0x40000000ul /* About 12 days */
+static struct task *bench_task;
+static volatile u32 bench_task_stamp;
+
+static void bench_task_job(void *arg)
+{
+	(void)arg;
+	bench_task_stamp = read_cycle_counter();
+}
+
+static void bench_create_task(void)
+{
+	int id = create_task(bench_task_job, NULL, BENCH_TASK_NEVER, 1,
+			BENCH_TASK_NEVER, 0, FPR, "bench");
+	
+	if (id < 0)
+		_panic(__FILE__, __LINE__, "Cannot create the benchmark task.");
+	bench_task = &taskset[id];
+}
+
+/* _sys_schedule() called by a task when no other task is ready:
+ * the registers are saved, the scheduler runs and the same task resumes */
+static void bench_yield(void)
+{
+	struct bench_stat s;
+	u32 start;
+	int i;
+	
+	bench_stat_init(&s);
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		irq_disable(); /* As in task_entry_point(): no tick in between */
+		start = read_cycle_counter();
+		_sys_schedule();
+		bench_stat_add(&s, read_cycle_counter() - start);
+		irq_enable();
+	}
+	bench_line("yield", "no_switch");
+	bench_result(&s);
+}
+
+/* _sys_schedule() when a task with higher priority is ready:
+ *   - switch_in: until its job starts;
+ *   - switch_round_trip: until its job completes and this task resumes. */
+static void bench_switch(void)
+{
+	struct bench_stat in, round_trip;
+	u32 start, end;
+	int i;
+	
+	bench_stat_init(&in);
+	bench_stat_init(&round_trip);
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		irq_disable();
+		release_job(bench_task);
+		start = read_cycle_counter();
+		_sys_schedule();
+		end = read_cycle_counter();
+		irq_enable();
+		bench_stat_add(&in, bench_task_stamp - start);
+		bench_stat_add(&round_trip, end - start);
+	}
+	bench_line("switch_in", "yield");
+	bench_result(&in);
+	bench_line("switch_round_trip", "yield");
+	bench_result(&round_trip);
+}
+
+/* Preemption latency: a job of the benchmark task is released, then the
+ * tick interrupt is let in. Measured from the moment the CPU can take the
+ * interrupt until the job of the preempting task starts: IRQ entry,
+ * isr_tick(), schedule() and the context switch. */
+static void bench_preemption(void)
+{
+	struct bench_stat s;
+	u32 start;
+	int i;
+	
+	bench_stat_init(&s);
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		bench_wait_tick();
+		release_job(bench_task);
+		bench_task_stamp = 0;
+		start = read_cycle_counter();
+		irq_enable(); /* Preempted here */
+		while (bench_task_stamp == 0);
+		bench_stat_add(&s, bench_task_stamp - start);
+	}
+	bench_line("preemption_latency", "tick");
+	bench_result(&s);
+}
+
+/* Time spent in puts() to print BENCH_PUTS_BYTES bytes */
+#define BENCH_PUTS_LINE "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde\n" /* 64 bytes */
+#define BENCH_PUTS_LINES 16
+#define BENCH_PUTS_BYTES (64 * BENCH_PUTS_LINES)
+#define BENCH_PUTS_RUNS 8
+
+static void bench_puts(void)
+{
+	struct bench_stat s;
+	u32 start;
+	int i, j;
+	
+	bench_stat_init(&s);
+	for (i = 0; i < BENCH_PUTS_RUNS; ++i) {
+		start = read_cycle_counter();
+		for (j = 0; j < BENCH_PUTS_LINES; ++j)
+			puts(BENCH_PUTS_LINE);
+		bench_stat_add(&s, read_cycle_counter() - start);
+	}
+	bench_line("puts", NULL);
+	bench_param("bytes", BENCH_PUTS_BYTES);
+	bench_result(&s);
+}
+
+/* Integer formatting (format.c) against the routines it replaced:
+ *   - fmt_u32: the digits of a number in a buffer, one division by 10 per
+ *     digit (old putu()) or one division by 100 per pair (fmt_dec());
+ *   - puth: one putc() per digit (old puth()) or one puts() per number;
+ *   - status_line: the line of cbs_worker printed with chained puts() and
+ *     putu() calls or with a single kprintf().
+ * The numbers have from 1 to 10 digits. The output goes to the UART, so
+ * every call is measured on its own, starting with an empty ring. */
+#define BENCH_FORMAT_VALUES 16
+
+static u32 bench_format_values[BENCH_FORMAT_VALUES];
+
+static void bench_format_init(void)
+{
+	u32 seed = 12345, v;
+	int i;
+	
+	for (i = 0; i < BENCH_FORMAT_VALUES; ++i) {
+		seed = seed * 1103515245u + 12345u; /* Linear congruential generator */
+		v = seed >> (i * 2 % 32); /* Values of every length */
+		bench_format_values[i] = v;
+	}
+}
+
+/* The digits loop of the old putu(). Not inlined, as fmt_dec() that is
+ * in another file, so that the compiler can't drop the unused digits. */
+static char * __attribute__((noinline)) bench_dec_div10(char *end, u32 v)
+{
+	do {
+		u32 w = v / 10;
+		*--end = (char) (v - w * 10 + '0');
+		v = w;
+	} while (v != 0);
+	return end;
+}
+
+/* The old puth() */
+static void bench_puth_putc(u32 v)
+{
+	int i, d;
+	u32 mask;
+	
+	puts("0x");
+	mask = 0xf0000000;
+	for (i = 0; mask != 0; i += 4, mask >>= 4) {
+		d = (v & mask) >> (28-i);
+		putc(d + (d > 9 ? 'a' - 10 : '0' ));
+	}
+}
+
+static void bench_status_chained(u32 v)
+{
+	puts("CBS server: job ");
+	putu(v);
+	puts(" prio=");
+	putu(v >> 8);
+	puts(" nextrel=");
+	putu(v >> 4);
+	puts(" pending=");
+	putu(v & 3);
+	puts(" budget=");
+	putu(v & 31);
+	puts("\n");
+}
+
+static void bench_status_kprintf(u32 v)
+{
+	kprintf("CBS server: job %u prio=%u nextrel=%u pending=%u budget=%u\n",
+	        v, v >> 8, v >> 4, v & 3, v & 31);
+}
+
+static void bench_format_call(const char *name, const char *variant, void (*f)(u32))
+{
+	struct bench_stat s;
+	u32 start;
+	int i;
+	
+#ifndef MINI_UART
+	while (!uart_tx_idle());
+#endif
+	bench_stat_init(&s);
+	for (i = 0; i < BENCH_FORMAT_VALUES; ++i) {
+		start = read_cycle_counter();
+		f(bench_format_values[i]);
+		bench_stat_add(&s, read_cycle_counter() - start);
+	}
+	puts("\n");
+	bench_line(name, variant);
+	bench_result(&s);
+}
+
+static void bench_puth_buffer(u32 v)
+{
+	puth(v);
+}
+
+static void bench_format(void)
+{
+	struct bench_stat div10, pairs;
+	char buf[FMT_DEC_DIGITS + 1];
+	u32 start;
+	int i, run;
+	
+	bench_format_init();
+	
+	bench_stat_init(&div10);
+	bench_stat_init(&pairs);
+	for (run = 0; run < BENCH_RUNS; ++run) {
+		for (i = 0; i < BENCH_FORMAT_VALUES; ++i) {
+			start = read_cycle_counter();
+			bench_dec_div10(buf + FMT_DEC_DIGITS, bench_format_values[i]);
+			bench_stat_add(&div10, read_cycle_counter() - start);
+			
+			start = read_cycle_counter();
+			fmt_dec(buf + FMT_DEC_DIGITS, bench_format_values[i]);
+			bench_stat_add(&pairs, read_cycle_counter() - start);
+		}
+	}
+	bench_line("fmt_u32", "div10");
+	bench_result(&div10);
+	bench_line("fmt_u32", "pairs");
+	bench_result(&pairs);
+	
+	bench_format_call("puth", "putc", bench_puth_putc);
+	bench_format_call("puth", "buffer", bench_puth_buffer);
+	bench_format_call("status_line", "chained", bench_status_chained);
+	bench_format_call("status_line", "kprintf", bench_status_kprintf);
+}
+
+/* UART0 throughput: BENCH_UART_BYTES bytes printed by polling the FIFO
+ * (putc_uart0_polled(), what putc() did before the transmission ring)
+ * and through the ring, which is drained by the TX interrupt or by DMA.
+ * For each one "cpu" is the time spent by the caller and "wall" the time
+ * until the last byte has left the UART; bytes_per_s comes from wall. */
+#ifndef MINI_UART
+
+#define BENCH_UART_BYTES 2048 /* Half of the ring: putc() never waits */
+
+static void bench_uart_report(const char *variant, u32 cpu, u32 wall)
+{
+	struct bench_stat s;
+	unsigned long long rate = (unsigned long long) BENCH_UART_BYTES * CYCLE_COUNTER_HZ;
+	
+	/* Each report is printed when the UART is idle, so it doesn't
+	 * disturb the next measure as long as it is shorter than a line */
+	udiv64(&rate, wall ? wall : 1);
+	
+	bench_stat_init(&s);
+	bench_stat_add(&s, cpu);
+	bench_line("uart_tx_cpu", variant);
+	bench_param("bytes", BENCH_UART_BYTES);
+	bench_result(&s);
+	
+	bench_stat_init(&s);
+	bench_stat_add(&s, wall);
+	bench_line("uart_tx_wall", variant);
+	bench_param("bytes", BENCH_UART_BYTES);
+	bench_param("bytes_per_s", (unsigned long) rate);
+	bench_result(&s);
+}
+
+static void bench_uart_tx(void)
+{
+	u32 start, cpu, wall;
+	int i;
+	
+	/* The results of the previous benchmarks are still in the ring */
+	while (!uart_tx_idle());
+	start = read_cycle_counter();
+	for (i = 0; i < BENCH_UART_BYTES; ++i)
+		putc_uart0_polled(i == BENCH_UART_BYTES - 1 ? '\n' : '.');
+	cpu = read_cycle_counter() - start;
+	while (!uart_tx_idle());
+	wall = read_cycle_counter() - start;
+	bench_uart_report("polled", cpu, wall);
+	
+	while (!uart_tx_idle());
+	start = read_cycle_counter();
+	for (i = 0; i < BENCH_UART_BYTES; ++i)
+		putc(i == BENCH_UART_BYTES - 1 ? '\n' : '.');
+	cpu = read_cycle_counter() - start;
+	while (!uart_tx_idle());
+	wall = read_cycle_counter() - start;
+#ifdef UART_DMA
+	bench_uart_report("dma", cpu, wall);
+#else
+	bench_uart_report("irq", cpu, wall);
+#endif
+}
+
+#endif /* MINI_UART */
+
+/* Cost of the cache maintenance operations, from a line to the whole
+ * data cache (16KB) doubling the size each time */
+#define BENCH_CACHE_MAX_SIZE 16384
+static char bench_buffer[BENCH_CACHE_MAX_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static void bench_dirty_buffer(unsigned long size)
+{
+	unsigned long i;
+	
+	for (i = 0; i < size; i += CACHE_LINE_SIZE)
+		bench_buffer[i]++;
+}
+
+static void bench_cache_report(const char *name, unsigned long size, u32 c)
+{
+	struct bench_stat s;
+	
+	bench_stat_init(&s);
+	bench_stat_add(&s, c);
+	bench_line(name, NULL);
+	bench_param("bytes", size);
+	bench_result(&s);
+}
+
+static void bench_cache_maintenance(void)
+{
+	unsigned long size;
+	u32 start, c;
+	
+	for (size = CACHE_LINE_SIZE; size <= BENCH_CACHE_MAX_SIZE; size <<= 1) {
+		bench_dirty_buffer(size);
+		start = read_cycle_counter();
+		dcache_clean_range(bench_buffer, size);
+		c = read_cycle_counter() - start;
+		bench_cache_report("dcache_clean_range", size, c);
+		
+		start = read_cycle_counter();
+		dcache_invalidate_range(bench_buffer, size);
+		c = read_cycle_counter() - start;
+		bench_cache_report("dcache_invalidate_range", size, c);
+		
+		bench_dirty_buffer(size);
+		start = read_cycle_counter();
+		dcache_clean_invalidate_range(bench_buffer, size);
+		c = read_cycle_counter() - start;
+		bench_cache_report("dcache_clean_invalidate_range", size, c);
+		
+		start = read_cycle_counter();
+		icache_invalidate_range(bench_buffer, size);
+		c = read_cycle_counter() - start;
+		bench_cache_report("icache_invalidate_range", size, c);
+		
+		/* The same amount of dirty lines flushed with a single operation */
+		bench_dirty_buffer(size);
+		start = read_cycle_counter();
+		dcache_clean_invalidate_all();
+		__synchronization_barrier();
+		c = read_cycle_counter() - start;
+		bench_cache_report("dcache_clean_invalidate_all", size, c);
+	}
+}
+
+/* Per-tick cost of the releases with the release queue (a min-heap, see
+ * release_due_tasks() in sched.c) and with the linear scan of all the
+ * tasks that check_periodic_tasks() used before. The tasks are not real:
+ * they live in a separate array, they are never scheduled and their
+ * periods and phases are pseudo-random. */
+#define BENCH_MAX_TASKS 512
+#define BENCH_TICKS 1024
+static struct task bench_tasks[BENCH_MAX_TASKS];
+static struct task *bench_nodes[BENCH_MAX_TASKS];
+static struct task_heap bench_queue;
+
+static void bench_init_tasks(int n, unsigned long now)
+{
+	u32 seed = 12345;
+	int i;
+	
+	for (i = 0; i < n; ++i) {
+		seed = seed * 1103515245u + 12345u; /* Linear congruential generator */
+		bench_tasks[i].valid = 1;
+		bench_tasks[i].period = 10 + ((seed >> 16) & 511); /* 10..521 ticks */
+		bench_tasks[i].releasetime = now + ((seed >> 8) & 255); /* First release within 256 ticks */
+		bench_tasks[i].released = 0;
+		bench_tasks[i].budget = 0;
+	}
+}
+
+/* Fake tasks must not enter the ready queues of the scheduler */
+static void bench_release_job(struct task *f)
+{
+	++f->released;
+}
+
+/* The loop of check_periodic_tasks() before the release queue */
+static void bench_scan_tasks(int n, unsigned long now)
+{
+	struct task *f;
+	int i;
+	
+	for (i = 0, f = bench_tasks; i < n; ++i, ++f) {
+		if (!f->valid)
+			continue;
+		if (time_after_eq(now, f->releasetime)) {
+			f->releasetime += f->period;
+			++f->released;
+		}
+	}
+}
+
+static void bench_release_queue(void)
+{
+	struct bench_stat s;
+	u32 start;
+	unsigned long tick;
+	int n, i;
+	
+	for (n = 8; n <= BENCH_MAX_TASKS; n <<= 2) {
+		/* Min-heap */
+		bench_init_tasks(n, 0);
+		init_heap(&bench_queue, bench_nodes, BENCH_MAX_TASKS,
+				offsetof(struct task, releasetime), offsetof(struct task, release_pos));
+		for (i = 0; i < n; ++i)
+			heap_insert(&bench_queue, &bench_tasks[i]);
+		bench_stat_init(&s);
+		for (tick = 0; tick < BENCH_TICKS; ++tick) {
+			irq_disable();
+			start = read_cycle_counter();
+			release_due_tasks(&bench_queue, tick, bench_release_job);
+			bench_stat_add(&s, read_cycle_counter() - start);
+			irq_enable();
+		}
+		bench_line("release_per_tick", "queue");
+		bench_param("tasks", n);
+		bench_result(&s);
+		
+		/* Linear scan with the same tasks */
+		bench_init_tasks(n, 0);
+		bench_stat_init(&s);
+		for (tick = 0; tick < BENCH_TICKS; ++tick) {
+			irq_disable();
+			start = read_cycle_counter();
+			bench_scan_tasks(n, tick);
+			bench_stat_add(&s, read_cycle_counter() - start);
+			irq_enable();
+		}
+		bench_line("release_per_tick", "scan");
+		bench_param("tasks", n);
+		bench_result(&s);
+	}
+}
+
+/* Stress of the ready queues with simultaneous releases.
+ * BENCH_STRESS_TASKS fake tasks, half EDF and half FPR, have periods of
+ * 16, 32 and 64 ticks and no phase: they share a hyperperiod of 64 ticks
+ * and all of them are released together at its beginning. Every tick one
+ * job (the one chosen by the scheduler) completes, so the utilization is
+ * exactly 1 and the backlog does not grow.
+ * For each tick is measured the cost of the releases plus the choice of
+ * the next task, i.e. the work done by isr_tick() and schedule().
+ * The scheduler lock keeps the real scheduler from running the fake tasks
+ * while they are in the ready queues. */
+#define BENCH_STRESS_TASKS 32
+
+static void bench_stress_release(struct task *f)
+{
+	++f->released;
+	if (f->released == 1)
+		sched_task_ready(f);
+}
+
+static void bench_stress_init_tasks(void)
+{
+	static const unsigned long periods[4] = { 16, 32, 64, 64 };
+	struct task *f;
+	int i;
+	
+	for (i = 0; i < BENCH_STRESS_TASKS; ++i) {
+		f = &bench_tasks[i];
+		f->valid = 1;
+		f->period = periods[i & 3];
+		f->releasetime = 0;
+		f->released = 0;
+		f->budget = 0;
+		f->ready_pos = -1;
+		if (i & 1) { /* EDF */
+			f->rel_deadline = f->period;
+			f->abs_deadline = f->period;
+		}
+		else { /* FPR */
+			f->rel_deadline = 0;
+			f->priority = i >> 1;
+		}
+	}
+}
+
+/* What task_entry_point() does when a job completes */
+static void bench_stress_job_done(struct task *t)
+{
+	--t->released;
+	if (t->rel_deadline != 0)
+		t->abs_deadline += t->period;
+	sched_job_done(t);
+}
+
+static void bench_stress(void)
+{
+	struct bench_stat s;
+	u32 start;
+	unsigned long tick;
+	struct task *t;
+	int i;
+	
+	sched_lock();
+	
+	bench_stress_init_tasks();
+	init_heap(&bench_queue, bench_nodes, BENCH_MAX_TASKS,
+			offsetof(struct task, releasetime), offsetof(struct task, release_pos));
+	for (i = 0; i < BENCH_STRESS_TASKS; ++i)
+		heap_insert(&bench_queue, &bench_tasks[i]);
+	
+	bench_stat_init(&s);
+	for (tick = 0; tick < BENCH_TICKS; ++tick) { /* 16 hyperperiods */
+		irq_disable();
+		start = read_cycle_counter();
+		release_due_tasks(&bench_queue, tick, bench_stress_release);
+		t = select_best_task();
+		bench_stat_add(&s, read_cycle_counter() - start);
+		if (t != &taskset[0])
+			bench_stress_job_done(t);
+		irq_enable();
+	}
+	
+	/* Remove from the ready queues the jobs still pending */
+	irq_disable();
+	for (i = 0; i < BENCH_STRESS_TASKS; ++i) {
+		if (bench_tasks[i].released) {
+			bench_tasks[i].released = 0;
+			sched_job_done(&bench_tasks[i]);
+		}
+	}
+	irq_enable();
+	
+	bench_line("release_select_per_tick", "stress");
+	bench_param("tasks", BENCH_STRESS_TASKS);
+	bench_result(&s);
+	
+	sched_unlock();
+}
+
+void run_benchmarks(void)
+{
+	puts("Running benchmarks...\n");
+	puts("@bench begin\n");
+	
+	/* _init() did not enable the caches in the benchmark build */
+	bench_schedule("caches_off");
+	bench_tick("caches_off");
+	
+	init_caches();
+	
+	bench_schedule("caches_on");
+	bench_tick("caches_on");
+	
+	bench_create_task();
+	bench_yield();
+	bench_switch();
+	bench_preemption();
+	bench_puts();
+	bench_format();
+#ifndef MINI_UART
+	bench_uart_tx();
+#endif
+	
+	bench_cache_maintenance();
+	bench_release_queue();
+	bench_stress();
+	
+	puts("@bench end\n");
+	puts("Benchmarks done.\n\n");
+}
+
+#endif /* BENCHMARK */
@@ -50,6 +50,12 @@ static void cbs_server(void *arg)
 	 * the value of released jobs of the task */
 }
 
+/* 1 if t is the task of a CBS server */
+int is_cbs_server(const struct task *t)
+{
+	return t->job == cbs_server;
+}
+
 /* Release a new aperiodic job.
  * @q: the queue from where to take the job
  * @wid: the type of job, must be in [0, MAX_NUM_WORKERS] interval
@@ -64,6 +70,7 @@ void activate_cbs_worker(struct cbs_queue *q, int wid)
 	irq_disable();
 	q->pending[wid]++;
 	t->released++;
+	trace(TRACE_RELEASE, t, t->released);
 	if (t->released == 1) { /* CBS server was empty */
 		/* If:
 		 *     - A new aperiodic job is released
@@ -81,14 +88,17 @@ void activate_cbs_worker(struct cbs_queue *q, int wid)
 		 *   - t->period is the period of the task and reload period of the CBS server
 		 *   - t->budget is the current budget
 		 */
+		unsigned long now = get_ticks();
 		u32 pd = t->abs_deadline * t->max_budget;
-		u32 tdbp = SYSTEM_TICKS * t->max_budget + t->budget * t->period;
+		u32 tdbp = now * t->max_budget + t->budget * t->period;
 		if (tdbp >= pd) {
-			t->abs_deadline = SYSTEM_TICKS + t->period;
+			t->abs_deadline = now + t->period;
 			t->budget = t->max_budget;
 			trigger_schedule = 1; /* Need to reschedule because priority changed */
 			++globalreleases;
 		}
+		sched_task_ready(t); /* Enter the EDF ready queue with its deadline */
+		stats_release(t);
 	}
 	irq_enable();
 }
@@ -98,14 +108,16 @@ void activate_cbs_worker(struct cbs_queue *q, int wid)
  * when an aperiodic job is running.
  * @t: the task associated with a CBS server
  */
-void decrease_cbs_budget(struct task *t)
+void __hot_text decrease_cbs_budget(struct task *t)
 {
 	t->budget--;
 	if (t->budget > 0)
 		return;
 	/* Budget reached 0, reload and postpone the deadline */
+	trace(TRACE_BUDGET_EXHAUSTED, t, 0);
 	t->budget = t->max_budget;
 	t->abs_deadline += t->period;
+	sched_deadline_changed(t);
 	
 	trigger_schedule = 1; /* Need to reschedule because priority changed */
 }
@@ -116,22 +128,22 @@ void decrease_cbs_budget(struct task *t)
  * @cbs_q: the structure of the CBS server
  * @name: a canonical name for the server
  * 
- * Returns the ID of the task. On error returns -1.
+ * Returns the ID of the task. On error returns a negative value (see
+ * create_task()): in particular ETASK_UNSCHED if there is not enough
+ * bandwidth left for the server.
  */
 int init_cbs(unsigned long max_cap, unsigned long period, struct cbs_queue *cbs_q,
 		const char *name)
 {
 	int tid;
-	irq_disable();
 	
 	/* Initialize cbs_q struct */
 	cbs_q->num_workers = 0;
-	tid = create_task(cbs_server, cbs_q, period, 1, max_cap, CBS, name);
-	if (tid == -1)
-		return -1;
+	tid = create_task(cbs_server, cbs_q, period, 0, 1, max_cap, CBS, name);
+	if (tid < 0)
+		return tid;
 	cbs_q->task = taskset + tid; /* Link the task structure allocated by create_task() */
 	
-	irq_enable();
 	return tid;
 }
 
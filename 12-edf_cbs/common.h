@@ -33,9 +33,18 @@ typedef void (*isr_t)(void);
 /* Define a data type that represent a job */
 typedef void (*job_t)(void *);
 
+/* Define a data type for a function that releases a job of a task */
+struct task;
+typedef void (*release_t)(struct task *);
+
 /* Define max number of tasks that can be scheduled */
 #define MAX_NUM_TASKS 32
 
+/* Number of priority levels of the FPR ready queue (see sched.c).
+ * Priorities from 0 to FPR_LEVELS - 2 have a level each, all the
+ * others share the lowest level and run in FIFO order. */
+#define FPR_LEVELS 32
+
 /* Type of real-time task */
 enum task_type {
 	FPR, /* Fixed priority (Rate Monotonic) */
@@ -43,6 +52,12 @@ enum task_type {
 	CBS  /* Aperiodic task (served with Constant Bandwidth Server) */
 };
 
+/* Registers of the VFP of a task (see vfp.c) */
+struct vfp_context {
+	unsigned long long d[16];       /* d0-d15 (also s0-s31) */
+	u32 fpscr;                      /* Status and control register */
+};
+
 /* This is a task.
  * Each istance of this data struct represent a released job. */
 struct task {
@@ -68,12 +83,52 @@ struct task {
 		unsigned long max_budget;     /* If CBS: max budget. */
 	};
 	unsigned long budget;           /* 0 for FPR and EDF task or current budget for CBS task */
+	unsigned long wcet;             /* Worst case execution time of a job (see admission.c) */
 	const char *name;               /* Just for debug: string that defines a name for this task */
 	
 	unsigned long sp;               /* Stack pointer for the task */
 	unsigned long regs[8];          /* Registers not saved by the interrupt handler: r4-r11 */
+	struct vfp_context vfp;         /* VFP registers, saved only when another task
+	                                 * uses the VFP (see vfp.c) */
+	
+	int release_pos;                /* Index in the release queue (see sched.c) */
+	struct task *ready_next;        /* Next task in the same FPR ready list */
+	int ready_pos;                  /* Index in the EDF ready queue or -1 */
 };
 
+/* Level of a FPR task in the ready queue (see sched.c) */
+static inline int fpr_level(const struct task *t)
+{
+	return t->priority < FPR_LEVELS - 1 ? t->priority : FPR_LEVELS - 1;
+}
+
+/* Errors returned by create_task() */
+#define ETASK_INVALID  (-1) /* Invalid parameters */
+#define ETASK_NOSLOT   (-2) /* There are already MAX_NUM_TASKS tasks */
+#define ETASK_UNSCHED  (-3) /* The taskset would not be schedulable (see admission.c) */
+
+/* Offset in bytes of a field inside a structure */
+#define offsetof(type, field) __builtin_offsetof(type, field)
+
+/* Min-heap of tasks (see heap.c) */
+struct task_heap {
+	struct task **node;             /* Array of the nodes. node[0] is the root */
+	int size;                       /* Number of tasks in the heap */
+	int capacity;                   /* Size of the node array */
+	unsigned int key;               /* Offset in struct task of the key */
+	unsigned int pos;               /* Offset in struct task of the index in the heap */
+};
+
+/* Access the key and the index of a task in the heap h */
+#define heap_key(h, t) (*(unsigned long *)((char *)(t) + (h)->key))
+#define heap_pos(h, t) (*(int *)((char *)(t) + (h)->pos))
+
+/* Task with the smallest key or NULL if the heap is empty: O(1) */
+static inline struct task *heap_top(struct task_heap *h)
+{
+	return h->size ? h->node[0] : NULL;
+}
+
 /* CBS data structure */
 #define MAX_NUM_WORKERS 8
 struct cbs_queue {
@@ -89,6 +144,60 @@ struct cbs_queue {
 	/* Job priority is the index of its type: workers[0] has higher priority than workers[1] */
 };
 
+/* Profiling regions.
+ * Every region has an entry in the table of pmu.c that accumulates the
+ * counters of the performance monitor between PROFILE_BEGIN(region) and
+ * PROFILE_END(region). Regions can nest (e.g. an IRQ during schedule())
+ * and the outer one includes the cost of the inner one. */
+enum profile_region {
+	PROFILE_IRQ,      /* _bsp_irq(): dispatch of all pending IRQs */
+	PROFILE_TICK,     /* isr_tick(): timer ISR, including releases */
+	PROFILE_SCHEDULE, /* schedule(): selection of the next task */
+	PROFILE_NUM_REGIONS
+};
+
+/* Events recorded in the trace (see trace.c) */
+enum trace_event {
+	TRACE_RELEASE,          /* A job of the task is released, arg: pending jobs */
+	TRACE_DISPATCH,         /* The task goes on the CPU, arg: ID of the previous task */
+	TRACE_COMPLETE,         /* A job of the task completed, arg: pending jobs */
+	TRACE_BUDGET_EXHAUSTED, /* The CBS server used all its budget */
+	TRACE_DEADLINE_MISS,    /* A job of the EDF task missed its deadline */
+	TRACE_IRQ_ENTRY,        /* The ISR of an IRQ starts, arg: IRQ number (only if it records
+	                         * other events, see trace_irq_exit()) */
+	TRACE_IRQ_EXIT,         /* The ISR of an IRQ returned, arg: IRQ number */
+};
+
+/* A record of the trace */
+struct trace_record {
+	u32 time;                       /* read_cycle_counter() */
+	unsigned char event;            /* enum trace_event */
+	unsigned char task;             /* ID of the task (current task for IRQs) */
+	unsigned short arg;
+};
+
+/* Number of records of the trace ring, must be a power of 2 */
+#define TRACE_RECORDS 1024
+
+/* A message of the deferred log (see klog.c): the format string is
+ * not printed when the message is written, just its address */
+#define KLOG_ARGS 6 /* Maximum number of arguments of a message */
+struct klog_record {
+	const char *fmt;     /* Format string, in .rodata */
+	u32 time;            /* Cycle counter */
+	u32 args[KLOG_ARGS]; /* Raw arguments */
+};
+
+/* Number of records of the log ring, must be a power of 2 */
+#define KLOG_RECORDS 256
+
+/* A snapshot of the counters of the performance monitor */
+struct pmu_sample {
+	u32 cycles;
+	u32 icache_misses;
+	u32 branch_mispredicts;
+};
+
 /* Global variables */
 extern volatile unsigned long SYSTEM_TICKS;
 extern struct task taskset[MAX_NUM_TASKS];
@@ -99,6 +208,12 @@ extern volatile unsigned long trigger_schedule; /* If 1 invoke the scheduler whe
                                                  * an IRQ occurs */
 extern struct cbs_queue cbs0; /* The only CBS server this program uses */
 
+/* Functions executed at every tick or context switch. The linker puts them
+ * in the .text.hot section (see sert.lds) that is locked in the instruction
+ * cache by lock_hot_text(), so their latency does not depend on what the
+ * previous task evicted. */
+#define __hot_text __attribute__((section(".text.hot")))
+
 /* Define the entry point function symbol that may be used by some functions
  * that include raspberry.h header file (such as init.c) */
 extern void entry(void);
@@ -110,32 +225,163 @@ extern void panic1(void);
 extern void panic2(void);
 extern void panic3(void);
 extern void panic4(void);
+extern void init_caches(void);
+extern void lock_hot_text(void);
+extern void init_mmu(void);
 extern void init_uart(void);
 extern void init_miniuart(void);
+extern void init_uart_irq(void);
+extern void uart_sync(void);
+extern int uart_tx_idle(void);
+extern unsigned long uart_tx_room(void);
+extern volatile unsigned long uart_rx_overruns;
+extern int putc_uart0_polled(int);
+/* What putc() does when the UART0 transmission ring is full */
+enum uart_tx_policy {
+	UART_TX_WAIT, /* Wait for room in the hardware FIFO (default) */
+	UART_TX_DROP  /* Discard the character */
+};
+extern enum uart_tx_policy uart_set_tx_policy(enum uart_tx_policy);
+extern volatile unsigned long uart_tx_dropped;
 extern int putc(int);
+extern int getc(void);
 extern int puts(const char*);
 extern int puth(unsigned long);
 extern int putu(unsigned long);
 extern int putd(long);
 extern int putf(double, int);
+extern int putq16(long, int);
+extern int putmicro(long);
+/* Formatting (see format.c) */
+#define FMT_DEC_DIGITS 10 /* Of a 32-bit number */
+#define FMT_HEX_DIGITS 8
+#define FMT_FIXED_MAX_PREC 9 /* Decimal digits of fmt_q16() */
+#define FMT_FIXED_DIGITS 17 /* Of fmt_q16() and fmt_micro(), with sign and point */
+#define KPRINTF_MAX 128 /* Longest output of kprintf(), with the '\0' */
+extern char *fmt_dec(char *end, u32 v);
+extern char *fmt_hex(char *end, u32 v, int min_digits);
+extern void put_hex_le(u32 v, int bytes);
+extern void put_hex_name(int id, const char *name);
+extern char *fmt_q16(char *end, long v, int prec);
+extern char *fmt_micro(char *end, long v);
+extern int ksnprintf(char *buf, unsigned long size, const char *fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+extern int kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 extern void init_irq(void);
+extern void dma_init_channel(int ch);
+extern void dma_start(int ch, struct dma_cb *cb);
+extern int dma_active(int ch);
+extern void dma_clear_int(int ch);
+extern int dma_ack(int ch);
 extern int register_isr_irq1(int, isr_t);
 extern int register_isr_irq2(int, isr_t);
 extern int register_isr_irq_basic(int, isr_t);
+#ifdef FIQ_TICK
+extern int register_isr_fiq(int, isr_t);
+#endif
 extern void init_ticks(void);
+extern void timer_dump(void);
+#ifdef TICKLESS
+extern unsigned long get_ticks(void);
+extern void tick_reprogram(struct task *running);
+extern void tick_wakeup(unsigned long expire);
+#else
+/* With a periodic tick SYSTEM_TICKS is always up to date */
+#define get_ticks() SYSTEM_TICKS
+#define tick_reprogram(running) do { } while (0)
+#define tick_wakeup(expire) do { } while (0)
+#endif
+/* VFP */
+#ifdef HOST_SIM
+#define vfp_switch(to) do { } while (0)
+#else
+extern struct task *vfp_owner;
+
+/* Called by schedule() when it chooses the task to: the VFP stays enabled
+ * only for the task that owns its registers, any other task traps at its
+ * first VFP instruction (see vfp.c) */
+static inline void vfp_switch(const struct task *to)
+{
+	if (to == vfp_owner)
+		enable_vfp();
+	else
+		disable_vfp();
+}
+#endif
 /* Scheduler */
 extern void init_taskset(void);
-extern int create_task(job_t, void *, unsigned long,
+extern void init_scheduler(void);
+extern void sched_add_task(struct task *t);
+extern int create_task(job_t, void *, unsigned long, unsigned long,
 		unsigned long, unsigned long, enum task_type,
 		const char *);
+extern int admission_test(struct task *t);
 extern void check_periodic_tasks(void);
+extern void release_job(struct task *f);
+extern void release_due_tasks(struct task_heap *q, unsigned long now, release_t release);
+extern void sched_task_ready(struct task *t);
+extern void sched_deadline_changed(struct task *t);
+extern void sched_job_done(struct task *t);
+extern unsigned long next_release_time(void);
+extern struct task *select_best_task(void);
 extern struct task * schedule(void);
+extern void sched_lock(void);
+extern void sched_unlock(void);
 extern void _sys_schedule(void);
+/* Min-heap */
+extern void init_heap(struct task_heap *h, struct task **node, int capacity,
+		unsigned int key, unsigned int pos);
+extern int heap_insert(struct task_heap *h, struct task *t);
+extern void heap_remove(struct task_heap *h, struct task *t);
+extern void heap_update(struct task_heap *h, struct task *t);
 /* CBS server */
 extern int init_cbs(unsigned long max_cap, unsigned long period, struct cbs_queue *cbs_q, const char *name);
 extern int add_cbs_worker(struct cbs_queue *cbs_q, job_t worker_fn, void *worker_arg);
 extern void activate_cbs_worker(struct cbs_queue *q, int wid);
 extern void decrease_cbs_budget(struct task *t);
+extern int is_cbs_server(const struct task *t);
+/* Console shell */
+extern void shell_job(void *arg);
+/* Performance monitor */
+extern void init_pmu(void);
+extern void profile_record(enum profile_region r, const struct pmu_sample *begin);
+extern void profile_dump(void);
+extern void profile_reset(void);
+/* Trace */
+extern struct trace_record trace_ring[TRACE_RECORDS];
+extern volatile u32 trace_head;
+extern int trace_flush(int max_records);
+/* Deferred log */
+extern struct klog_record klog_ring[KLOG_RECORDS];
+extern volatile u32 klog_head;
+extern volatile u32 klog_tail;
+extern volatile u32 klog_lost;
+extern int klog_flush(int max_records);
+/* Execution time statistics (compile with "make stats") */
+#ifdef TASK_STATS
+extern void stats_release(struct task *t);
+extern void stats_switch(struct task *from, struct task *to);
+extern void stats_job_begin(struct task *t);
+extern void stats_job_end(struct task *t);
+extern void stats_dump(void);
+extern unsigned long stats_dump_size(void);
+extern void stats_reset(void);
+#else
+/* Nothing is compiled in the normal build */
+#define stats_release(t) do { } while (0)
+#define stats_switch(from, to) do { } while (0)
+#define stats_job_begin(t) do { } while (0)
+#define stats_job_end(t) do { } while (0)
+#define stats_reset() do { } while (0)
+#endif
+/* Division */
+extern u32 udiv64(unsigned long long *n, u32 d);
+#ifdef BENCHMARK
+/* Benchmarks (compile with "make benchmark") */
+extern volatile u32 bench_tick_stamp;
+extern volatile u32 bench_tick_end;
+extern void run_benchmarks(void);
+#endif
 
 /* inline tells to the compiler to optimize, when possible, this function
  * replacing the function call with the function itself */ 
@@ -168,15 +414,17 @@ static inline void loop_delay(unsigned long d)
 
 static inline void delay_ticks(unsigned long d)
 {
-	unsigned long expire = d + SYSTEM_TICKS;
+	unsigned long expire = d + get_ticks();
 	/* time_before() avoid problems when SYSTEM_TICKS is near his
 	 * register capacity. There's a period of time when expire
 	 * variable is forward in time in respect of SYSTEM_TICKS,
 	 * but his unsigned value is <.
 	 * In order to consider always the correct difference of time,
 	 * we must use a signed value comparison. */
-	while (time_before(SYSTEM_TICKS, expire))
+	while (time_before(get_ticks(), expire)) {
+		tick_wakeup(expire); /* Tickless mode: next IRQ must not come later */
 		__wfi(); /* Put the CPU in low power state until next IRQ */
+	}
 }
 
 static inline void delay_ms(unsigned long ms)
@@ -184,11 +432,132 @@ static inline void delay_ms(unsigned long ms)
 	/* We don't simply call delay_ticks(ms * HZ / 1000) because
 	 * we want this code to be as short as possible. A function call
 	 * would cause saving and restoring registers on the stack */
-	unsigned long expire = (ms * HZ / 1000) + SYSTEM_TICKS;
-	while (time_before(SYSTEM_TICKS, expire))
+	unsigned long expire = (ms * HZ / 1000) + get_ticks();
+	while (time_before(get_ticks(), expire)) {
+		tick_wakeup(expire); /* Tickless mode: next IRQ must not come later */
 		__wfi(); /* Put the CPU in low power state until next IRQ */
+	}
 }
 
 #define delay_s(seconds) delay_ms((seconds) * 1000)
 
 #define get_ticks_in_sec(seconds) ((seconds) * HZ)
+
+
+
+/* PROFILING (compile with "make profile") */
+
+static inline void pmu_read(struct pmu_sample *s)
+{
+	s->cycles = read_cycle_counter();
+	s->icache_misses = read_pmn0();
+	s->branch_mispredicts = read_pmn1();
+}
+
+#ifdef PROFILE
+#define PROFILE_BEGIN(region) \
+	struct pmu_sample __profile_##region; \
+	pmu_read(&__profile_##region)
+#define PROFILE_END(region) profile_record(region, &__profile_##region)
+#else
+/* Nothing is compiled in the normal build */
+#define PROFILE_BEGIN(region) do { } while (0)
+#define PROFILE_END(region) do { } while (0)
+#endif
+
+
+
+/* TRACING (see trace.c) */
+
+/* Append a record to the trace ring, overwriting the oldest one.
+ * Must be called with IRQs disabled: all the events happen in the tick
+ * ISR, in the scheduler or in task_entry_point() after irq_disable(). */
+static inline void trace(enum trace_event e, const struct task *t, u32 arg)
+{
+	u32 head = trace_head;
+	struct trace_record *r = &trace_ring[head & (TRACE_RECORDS - 1)];
+	
+	r->time = read_cycle_counter();
+	r->event = e;
+	r->task = t - taskset;
+	r->arg = arg;
+	trace_head = head + 1;
+}
+
+/* Record the entry in the ISR of IRQ n. Returns the number of its record
+ * for trace_irq_exit(); the record it overwrites is kept in *saved. */
+static inline u32 trace_irq_entry(int n, struct trace_record *saved)
+{
+	u32 head = trace_head;
+	
+	*saved = trace_ring[head & (TRACE_RECORDS - 1)];
+	trace(TRACE_IRQ_ENTRY, current, n);
+	return head;
+}
+
+/* Record the exit from the ISR of IRQ n, whose entry is the record head.
+ * If the ISR recorded nothing (a tick that releases no job, the serial
+ * line, also while it sends the trace itself) the entry is taken back:
+ * those IRQs would be most of the records, more than the serial line can
+ * carry, and tell nothing about the schedule. */
+static inline void trace_irq_exit(int n, u32 head, const struct trace_record *saved)
+{
+	if (trace_head == head + 1) {
+		trace_ring[head & (TRACE_RECORDS - 1)] = *saved;
+		trace_head = head;
+	} else {
+		trace(TRACE_IRQ_EXIT, current, n);
+	}
+}
+
+
+
+/* DEFERRED LOGGING (see klog.c) */
+
+/* Append a message to the log ring. If the ring is full the message is
+ * dropped (and counted in klog_lost): the oldest ones are still waiting
+ * to be printed and are usually more interesting. */
+static inline void klog_write(const char *fmt, u32 a0, u32 a1, u32 a2,
+		u32 a3, u32 a4, u32 a5)
+{
+	unsigned long flags;
+	struct klog_record *r;
+	u32 head;
+	
+	irq_save(flags);
+	head = klog_head;
+	if (head - klog_tail == KLOG_RECORDS) {
+		klog_lost++;
+	} else {
+		r = &klog_ring[head & (KLOG_RECORDS - 1)];
+		r->fmt = fmt;
+		r->time = read_cycle_counter();
+		r->args[0] = a0;
+		r->args[1] = a1;
+		r->args[2] = a2;
+		r->args[3] = a3;
+		r->args[4] = a4;
+		r->args[5] = a5;
+		klog_head = head + 1;
+	}
+	irq_restore(flags);
+}
+
+/* klog(fmt, ...) logs a message with up to KLOG_ARGS arguments, that
+ * must be integers or pointers to strings that never change (%s).
+ * The macros below pick klog_<number of arguments>() and fill the
+ * missing arguments with 0. */
+#define KLOG_ARG(a) ((u32)(unsigned long)(a))
+#define klog_0(f) klog_write(f, 0, 0, 0, 0, 0, 0)
+#define klog_1(f, a) klog_write(f, KLOG_ARG(a), 0, 0, 0, 0, 0)
+#define klog_2(f, a, b) klog_write(f, KLOG_ARG(a), KLOG_ARG(b), 0, 0, 0, 0)
+#define klog_3(f, a, b, c) klog_write(f, KLOG_ARG(a), KLOG_ARG(b), KLOG_ARG(c), 0, 0, 0)
+#define klog_4(f, a, b, c, d) klog_write(f, KLOG_ARG(a), KLOG_ARG(b), KLOG_ARG(c), \
+		KLOG_ARG(d), 0, 0)
+#define klog_5(f, a, b, c, d, e) klog_write(f, KLOG_ARG(a), KLOG_ARG(b), KLOG_ARG(c), \
+		KLOG_ARG(d), KLOG_ARG(e), 0)
+#define klog_6(f, a, b, c, d, e, g) klog_write(f, KLOG_ARG(a), KLOG_ARG(b), KLOG_ARG(c), \
+		KLOG_ARG(d), KLOG_ARG(e), KLOG_ARG(g))
+#define KLOG_SELECT(_0, _1, _2, _3, _4, _5, _6, name, ...) name
+#define klog(...) KLOG_SELECT(__VA_ARGS__, klog_6, klog_5, klog_4, klog_3, \
+		klog_2, klog_1, klog_0, klog_too_many_arguments)(__VA_ARGS__)
@@ -0,0 +1,47 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* The ARM1176 has no division instruction and the program is linked
+ * without libgcc, so there's no helper function for the "/" operator
+ * when the divisor is not a constant (with a constant divisor the
+ * compiler uses a multiplication instead).
+ * Where a division is needed, use these functions. */
+
+/* Divide *n by d, leaving the quotient in *n.
+ * Returns the remainder. d must not be 0.
+ * Bit by bit long division, always 64 iterations. Only shifts by a
+ * constant are used: they do not need helper functions either. */
+u32 udiv64(unsigned long long *n, u32 d)
+{
+	unsigned long long rem = 0, q = 0, v = *n;
+	int i;
+	
+	for (i = 0; i < 64; ++i) {
+		rem = (rem << 1) | (v >> 63); /* Bring down the next bit */
+		v <<= 1;
+		q <<= 1;
+		if (rem >= d) {
+			rem -= d;
+			q |= 1u;
+		}
+	}
+	*n = q;
+	return (u32) rem;
+}
@@ -0,0 +1,86 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Driver of the DMA controller.
+ * 
+ * A transfer is described by a list of control blocks (struct dma_cb)
+ * in memory: the channel walks the list by itself, so the CPU just
+ * prepares the blocks, starts the channel and gets an interrupt when a
+ * block with DMA_TI_INTEN completes. */
+
+/* Reset channel ch and enable it globally. The firmware reserves some
+ * channels for the GPU: the free ones are those in dma.chanmask of
+ * config.txt (0x7f35 by default). */
+void dma_init_channel(int ch)
+{
+	iomem_high(DMA_ENABLE, 1u << ch);
+	iomem(DMA_CS(ch)) = DMA_CS_RESET;
+	while (iomem(DMA_CS(ch)) & DMA_CS_RESET);
+	
+	/* Clear old errors and interrupts */
+	iomem(DMA_DEBUG(ch)) = DMA_DEBUG_ERRORS;
+	iomem(DMA_CS(ch)) = DMA_CS_END | DMA_CS_INT;
+}
+
+/* Start channel ch on the list of control blocks that begins with cb.
+ * The blocks and the data they read must have been cleaned from the data
+ * cache by the caller (dcache_clean_range()): the DMA controller reads
+ * memory, not the ARM caches. */
+void dma_start(int ch, struct dma_cb *cb)
+{
+	iomem(DMA_CONBLK_AD(ch)) = DMA_BUS_RAM(cb);
+	/* Make sure that the address is written before starting */
+	__synchronization_barrier();
+	iomem(DMA_CS(ch)) = DMA_CS_ACTIVE | DMA_CS_END | DMA_CS_INT |
+	                    DMA_CS_PRIORITY(1) | DMA_CS_PANIC_PRIORITY(1) |
+	                    DMA_CS_WAIT_FOR_OUTSTANDING_WRITES;
+}
+
+/* Non-zero while channel ch is transferring */
+int dma_active(int ch)
+{
+	return iomem(DMA_CS(ch)) & DMA_CS_ACTIVE;
+}
+
+/* Writing 0 to ACTIVE pauses a running channel, so the writes below
+ * that clear END and INT copy ACTIVE from the value just read. If the
+ * channel stops in between, ACTIVE is written back with no control block
+ * loaded, which does nothing (the Linux driver relies on this too). */
+
+/* Clear the interrupt of channel ch, without stopping a transfer that has
+ * been started in the meantime */
+void dma_clear_int(int ch)
+{
+	iomem(DMA_CS(ch)) = DMA_CS_INT | (iomem(DMA_CS(ch)) & DMA_CS_ACTIVE);
+}
+
+/* Acknowledge the completion of the transfer of channel ch.
+ * Returns non-zero if the channel stopped because of an error. */
+int dma_ack(int ch)
+{
+	u32 cs = iomem(DMA_CS(ch));
+	
+	iomem(DMA_CS(ch)) = DMA_CS_END | DMA_CS_INT | (cs & DMA_CS_ACTIVE);
+	if (cs & DMA_CS_ERROR) {
+		iomem(DMA_DEBUG(ch)) = DMA_DEBUG_ERRORS;
+		return 1;
+	}
+	return 0;
+}
@@ -37,17 +37,9 @@ static void cbs_worker(void *arg)
 	struct task *t = q->task;
 	static unsigned int count = 0;
 
-	puts("CBS server: job ");
-	putu(++count);
-	puts(" prio=");
-	putu(t->priority);
-	puts(" nextrel=");
-	putu(t->releasetime);
-	puts(" pending=");
-	putu(q->pending[0]);
-	puts(" budget=");
-	putu(t->budget);
-	puts("\n");
+	/* Printed later by the idle task (see klog.c) */
+	klog("CBS server: job %u prio=%u nextrel=%u pending=%u budget=%u\n",
+	     ++count, t->priority, t->releasetime, q->pending[0], t->budget);
 	
 	/* Wasting time... */
 	delay_ms(2000);
@@ -66,13 +58,46 @@ static void led_cycle(void *arg)
 
 static void show_ticks(void *arg __attribute__((unused)))
 {
-	puts("Tick! ");putu(SYSTEM_TICKS);puts("\n");
+	klog("Tick! %u\n", get_ticks());
 }
 
+#ifdef PROFILE
+static void show_profile(void *arg __attribute__((unused)))
+{
+	profile_dump();
+	profile_reset();
+}
+#endif
+
+#ifdef TRACE_DRAIN
+/* A record takes about 17 characters on the serial line, so the line
+ * could carry about 650 records per second. The tasks of this file record
+ * about 100 events per second (the IRQs without events are not recorded,
+ * see trace_irq_exit()): 256 records per second keep up with them, the
+ * ring holds 4 drains, and most of the line is left to the console. */
+#define TRACE_DRAIN_RECORDS 256 /* About 4.5KB on the serial line */
+static void trace_drain(void *arg __attribute__((unused)))
+{
+	trace_flush(TRACE_DRAIN_RECORDS); /* Decode it with tools/trace_decode.py */
+}
+#endif
+
+#ifdef TASK_STATS
+static void show_stats(void *arg __attribute__((unused)))
+{
+	stats_dump(); /* Decode it with tools/stats_decode.py */
+}
+#endif
+
 static void idle_task(void)
 {
-	for(;;)
+	for(;;) {
+		/* Nothing else to do: format the messages logged by the jobs.
+		 * A message logged by an ISR after the flush waits until the
+		 * idle task runs again, after the next interrupt. */
+		klog_flush(0);
 		__wfi();
+	}
 }
 
 void entry(void)
@@ -86,6 +111,12 @@ void entry(void)
 	
 	welcome();
 	
+#ifdef BENCHMARK
+	/* Run them before any task is created, so that no job
+	 * can preempt the measurements */
+	run_benchmarks();
+#endif
+	
 	/* cbs0 is the CBS server defined in this project (cbs.c)
 	 * and initialized in _init() function in init.c */
 	wid = add_cbs_worker(&cbs0, cbs_worker, &cbs0);
@@ -96,23 +127,76 @@ void entry(void)
 	if (create_task(led_cycle,
 			&wid,                   /* ID of the CBS worker as argument for this task */
 			get_ticks_in_sec(2),    /* Every 2 seconds */
+			110 * HZ / 1000,        /* WCET: 100 ms with the LED on, plus some margin */
 			5,                      /* Initial phase */
 			get_ticks_in_sec(2),    /* Relative deadline: 2 seconds apart from release time */
 			EDF,                    /* Earliest Deadline First */
-			"led_cycle") == -1) {
+			"led_cycle") < 0) {
 		_panic(__FILE__, __LINE__, "Cannot create task led_cycle.");
 	}
 	
 	if (create_task(show_ticks,
 			NULL,
 			get_ticks_in_sec(1),    /* Every second */
+			2,                      /* WCET: a short message on the serial line */
 			5,                      /* Initial phase */
 			get_ticks_in_sec(1),    /* Relative deadline: 1 second apart from release time */
 			EDF,                    /* Earliest Deadline First */
-			"show_ticks") == -1) {
+			"show_ticks") < 0) {
 		_panic(__FILE__, __LINE__, "Cannot create task show_ticks.");
 	}
 	
+#ifdef PROFILE
+	if (create_task(show_profile,
+			NULL,
+			get_ticks_in_sec(10),   /* Every 10 seconds */
+			HZ / 10,                /* WCET: the table of profile_dump() */
+			get_ticks_in_sec(10),   /* Initial phase */
+			MAXUINT,                /* Lowest priority */
+			FPR,                    /* Fixed priority */
+			"show_profile") < 0) {
+		_panic(__FILE__, __LINE__, "Cannot create task show_profile.");
+	}
+#endif
+	
+#ifdef TRACE_DRAIN
+	if (create_task(trace_drain,
+			NULL,
+			get_ticks_in_sec(1),    /* Every second */
+			HZ * 2 / 5,             /* WCET: TRACE_DRAIN_RECORDS records on the serial line */
+			get_ticks_in_sec(1),    /* Initial phase */
+			MAXUINT,                /* Lowest priority */
+			FPR,                    /* Fixed priority */
+			"trace_drain") < 0) {
+		_panic(__FILE__, __LINE__, "Cannot create task trace_drain.");
+	}
+#endif
+	
+#ifdef TASK_STATS
+	if (create_task(show_stats,
+			NULL,
+			get_ticks_in_sec(10),   /* Every 10 seconds */
+			HZ / 5,                 /* WCET: about 2KB on the serial line */
+			get_ticks_in_sec(10),   /* Initial phase */
+			MAXUINT,                /* Lowest priority */
+			FPR,                    /* Fixed priority */
+			"show_stats") < 0) {
+		_panic(__FILE__, __LINE__, "Cannot create task show_stats.");
+	}
+#endif
+	
+	if (create_task(shell_job,
+			NULL,
+			get_ticks_in_sec(1) / 10, /* Every 100 ms: reads what has been typed */
+			HZ / 100,               /* WCET: a command with less than 3KB of output */
+			get_ticks_in_sec(1),    /* Initial phase */
+			MAXUINT,                /* Lowest priority */
+			FPR,                    /* Fixed priority */
+			"shell") < 0) {
+		_panic(__FILE__, __LINE__, "Cannot create task shell.");
+	}
+	puts("Type \"help\" and Enter for the list of commands.\n> ");
+	
 	/* This is the task 0, those that the scheduler runs when no other tasks are eligible.
 	 * Let put the CPU in a low power state until next interrupt */
 	idle_task();
@@ -0,0 +1,297 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h> /* One of the headers provided also by a freestanding compiler */
+#include "raspberry.h"
+
+/* Integer formatting without divisions.
+ * 
+ * The ARM1176 has no division instruction: a division by a constant is
+ * compiled as a multiplication by its reciprocal (umull) and a shift,
+ * which is still the most expensive part of printing a number.
+ * fmt_dec() divides by 100 and takes two digits at a time from a table,
+ * halving the multiplications of the digit by digit loop.
+ * 
+ * The functions write the digits backward, ending just before end, and
+ * return a pointer to the first one: the caller provides a buffer large
+ * enough (FMT_DEC_DIGITS or FMT_HEX_DIGITS bytes) and terminates it. */
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* Decimal digits of v */
+char *fmt_dec(char *end, u32 v)
+{
+	u32 q, r;
+	
+	while (v >= 100) {
+		q = v / 100; /* A multiplication, see above */
+		r = (v - q * 100) * 2;
+		*--end = digit_pairs[r + 1];
+		*--end = digit_pairs[r];
+		v = q;
+	}
+	if (v >= 10) {
+		*--end = digit_pairs[v * 2 + 1];
+		*--end = digit_pairs[v * 2];
+	} else {
+		*--end = '0' + v;
+	}
+	return end;
+}
+
+/* Hexadecimal digits of v, at least min_digits (up to 8) */
+char *fmt_hex(char *end, u32 v, int min_digits)
+{
+	char *p = end;
+	
+	do {
+		*--p = "0123456789abcdef"[v & 0xf];
+		v >>= 4;
+	} while (v != 0);
+	while (end - p < min_digits)
+		*--p = '0';
+	return p;
+}
+
+/* Binary dumps (the @stats, @trace and @klog lines): the bytes of v from
+ * the least significant one, two hexadecimal digits each. Little-endian
+ * like the ARM, so the decoders read them with a plain struct.unpack(). */
+void put_hex_le(u32 v, int bytes)
+{
+	char buf[2 * sizeof(u32) + 1];
+	char *p = buf;
+	
+	while (bytes-- > 0) {
+		*p++ = "0123456789abcdef"[(v >> 4) & 0xf];
+		*p++ = "0123456789abcdef"[v & 0xf];
+		v >>= 8;
+	}
+	*p = '\0';
+	puts(buf);
+}
+
+/* An entry of the task name tables of the binary dumps: u8 id, u8 length
+ * of the name (up to 255 bytes), the name */
+void put_hex_name(int id, const char *name)
+{
+	int len;
+	
+	for (len = 0; name[len] && len < 255; ++len);
+	put_hex_le(id, 1);
+	put_hex_le(len, 1);
+	while (len--)
+		put_hex_le(*name++, 1);
+}
+
+/* Fixed point numbers, formatted with integer operations only: a job or
+ * an ISR that prints them never touches the VFP (see putf() in uart.c). */
+
+static const u32 powers_of_10[FMT_FIXED_MAX_PREC + 1] = {
+	1u, 10u, 100u, 1000u, 10000u, 100000u,
+	1000000u, 10000000u, 100000000u, 1000000000u
+};
+
+/* Write prec digits of frac (less than 10^prec) after a point */
+static char *fmt_fraction(char *end, u32 frac, int prec)
+{
+	char *p = fmt_dec(end, frac);
+	
+	while (end - p < prec)
+		*--p = '0'; /* Leading zeros of the fraction */
+	*--p = '.';
+	return p;
+}
+
+/* Signed Q16.16 number v (v / 65536) with prec decimal digits, from 0 to
+ * FMT_FIXED_MAX_PREC. The result is rounded to the nearest, ties away
+ * from zero: the 16 binary digits of the fraction times 10^prec fit in
+ * 64 bits, so the rounding is exact. */
+char *fmt_q16(char *end, long v, int prec)
+{
+	u32 mag = v < 0 ? 0u - (u32) v : (u32) v;
+	u32 ipart = mag >> 16;
+	u32 frac;
+	char *p = end;
+	
+	if (prec < 0)
+		prec = 0;
+	if (prec > FMT_FIXED_MAX_PREC)
+		prec = FMT_FIXED_MAX_PREC;
+	
+	frac = (u32) (((unsigned long long) (mag & 0xffffu) * powers_of_10[prec] + 0x8000u) >> 16);
+	if (frac == powers_of_10[prec]) { /* Rounded up to the next integer */
+		frac = 0;
+		ipart++;
+	}
+	
+	if (prec)
+		p = fmt_fraction(p, frac, prec);
+	p = fmt_dec(p, ipart);
+	if (v < 0 && (ipart | frac)) /* Not "-0.00" */
+		*--p = '-';
+	return p;
+}
+
+/* Signed number of millionths (e.g. microseconds as seconds), all the
+ * 6 decimal digits: no rounding is needed */
+char *fmt_micro(char *end, long v)
+{
+	u32 mag = v < 0 ? 0u - (u32) v : (u32) v;
+	u32 ipart = mag / 1000000u; /* A multiplication, see above */
+	char *p;
+	
+	p = fmt_fraction(end, mag - ipart * 1000000u, 6);
+	p = fmt_dec(p, ipart);
+	if (v < 0)
+		*--p = '-';
+	return p;
+}
+
+/* Format fmt in buf, like vsnprintf() of the C library. Conversions:
+ *   %u, %d, %x, %c, %s and %%,
+ * with an optional '-' flag (align to the left), '0' flag (pad numbers
+ * with zeros) and width, e.g. "%-10s" or "%08x". The 'l' modifier is
+ * accepted and ignored (long and int are both 32 bits).
+ * At most size - 1 characters are written, followed by '\0'.
+ * Returns the length of the whole formatted string, that is larger than
+ * size - 1 if it was truncated. */
+static int kvsnprintf(char *buf, unsigned long size, const char *fmt, va_list ap)
+{
+	char num[FMT_DEC_DIGITS + 1]; /* Also for FMT_HEX_DIGITS + 1 */
+	char *end = num + sizeof(num) - 1;
+	const char *s;
+	unsigned long n = 0;
+	int width, left, zero, neg, len, pad;
+	int d;
+	
+#define EMIT(c) do { if (n + 1 < size) buf[n] = (c); ++n; } while (0)
+	
+	*end = '\0';
+	for (; *fmt; ++fmt) {
+		if (*fmt != '%') {
+			EMIT(*fmt);
+			continue;
+		}
+		
+		/* Flags and width */
+		left = zero = 0;
+		for (++fmt; *fmt == '-' || *fmt == '0'; ++fmt) {
+			if (*fmt == '-')
+				left = 1;
+			else
+				zero = 1;
+		}
+		for (width = 0; *fmt >= '0' && *fmt <= '9'; ++fmt)
+			width = width * 10 + *fmt - '0';
+		if (*fmt == 'l')
+			++fmt;
+		
+		neg = 0;
+		switch (*fmt) {
+		case 'u':
+			s = fmt_dec(end, va_arg(ap, unsigned int));
+			break;
+		case 'd':
+			d = va_arg(ap, int);
+			neg = d < 0;
+			s = fmt_dec(end, neg ? 0u - (u32) d : (u32) d);
+			break;
+		case 'x':
+			s = fmt_hex(end, va_arg(ap, unsigned int), 1);
+			break;
+		case 'c':
+			num[0] = (char) va_arg(ap, int);
+			num[1] = '\0';
+			s = num;
+			zero = 0;
+			break;
+		case 's':
+			s = va_arg(ap, const char *);
+			if (s == NULL)
+				s = "(null)";
+			zero = 0;
+			break;
+		case '%':
+			EMIT('%');
+			continue;
+		case '\0':
+			--fmt; /* The loop stops at the end of the string */
+			continue;
+		default: /* Not supported: print it as it is */
+			EMIT('%');
+			EMIT(*fmt);
+			continue;
+		}
+		
+		for (len = neg; s[len - neg]; ++len);
+		pad = width > len ? width - len : 0;
+		
+		if (!left && !zero)
+			for (; pad > 0; --pad)
+				EMIT(' ');
+		if (neg)
+			EMIT('-');
+		if (!left) /* zero */
+			for (; pad > 0; --pad)
+				EMIT('0');
+		for (; *s; ++s)
+			EMIT(*s);
+		for (; pad > 0; --pad) /* left */
+			EMIT(' ');
+	}
+	
+	if (size)
+		buf[n < size ? n : size - 1] = '\0';
+	return n;
+	
+#undef EMIT
+}
+
+int ksnprintf(char *buf, unsigned long size, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	
+	va_start(ap, fmt);
+	n = kvsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+/* Print a formatted string with a single puts().
+ * The output is truncated to KPRINTF_MAX - 1 characters. */
+int kprintf(const char *fmt, ...)
+{
+	char buf[KPRINTF_MAX];
+	va_list ap;
+	
+	va_start(ap, fmt);
+	kvsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	return puts(buf);
+}
@@ -0,0 +1,129 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Binary min-heap of tasks.
+ * The heap is an array where the children of node[i] are node[2i+1] and
+ * node[2i+2], so the parent of node[i] is node[(i-1)/2]. Every node has a
+ * key not greater than those of its children: the root node[0] is always
+ * the task with the smallest key.
+ * The key is an unsigned long of struct task (e.g. releasetime) selected
+ * by its offset when the heap is initialized, so the same code handles
+ * queues ordered by different fields. Keys are ticks, so they are compared
+ * with time_before() in order to survive the overflow of SYSTEM_TICKS.
+ * Each task also records its own index in the heap: this allows to update
+ * or remove a task without searching it.
+ * All these functions must be called with IRQs disabled if the heap is
+ * used by an interrupt handler. */
+
+/* Move up the task at index i until its parent has a smaller key */
+static void __hot_text sift_up(struct task_heap *h, int i)
+{
+	struct task *t = h->node[i], *p;
+	int parent;
+	
+	while (i > 0) {
+		parent = (i - 1) >> 1;
+		p = h->node[parent];
+		if (!time_before(heap_key(h, t), heap_key(h, p)))
+			break;
+		h->node[i] = p; /* Move the parent down one level */
+		heap_pos(h, p) = i;
+		i = parent;
+	}
+	h->node[i] = t;
+	heap_pos(h, t) = i;
+}
+
+/* Move down the task at index i until its children have greater keys */
+static void __hot_text sift_down(struct task_heap *h, int i)
+{
+	struct task *t = h->node[i], *c;
+	int child;
+	
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= h->size)
+			break; /* This is a leaf */
+		/* Choose the child with the smallest key */
+		if (child + 1 < h->size &&
+				time_before(heap_key(h, h->node[child + 1]), heap_key(h, h->node[child])))
+			++child;
+		c = h->node[child];
+		if (!time_before(heap_key(h, c), heap_key(h, t)))
+			break;
+		h->node[i] = c; /* Move the child up one level */
+		heap_pos(h, c) = i;
+		i = child;
+	}
+	h->node[i] = t;
+	heap_pos(h, t) = i;
+}
+
+/* Initialize an empty heap
+ * @h: the heap
+ * @node: array of capacity elements used to store the heap
+ * @capacity: max number of tasks in the heap
+ * @key: offset in struct task of the key (an unsigned long)
+ * @pos: offset in struct task of the index of the task in the heap (an int)
+ */
+void init_heap(struct task_heap *h, struct task **node, int capacity,
+		unsigned int key, unsigned int pos)
+{
+	h->node = node;
+	h->size = 0;
+	h->capacity = capacity;
+	h->key = key;
+	h->pos = pos;
+}
+
+/* Add a task to the heap: O(log n)
+ * Returns 0 on success or -1 if the heap is full. */
+int __hot_text heap_insert(struct task_heap *h, struct task *t)
+{
+	if (h->size == h->capacity)
+		return -1;
+	h->node[h->size] = t;
+	sift_up(h, h->size++);
+	return 0;
+}
+
+/* Remove a task from the heap: O(log n) */
+void __hot_text heap_remove(struct task_heap *h, struct task *t)
+{
+	int i = heap_pos(h, t);
+	struct task *last;
+	
+	heap_pos(h, t) = -1; /* Not in the heap anymore */
+	last = h->node[--h->size];
+	if (i == h->size)
+		return; /* t was the last node */
+	
+	/* Fill the hole with the last node and move it where it belongs */
+	h->node[i] = last;
+	heap_pos(h, last) = i;
+	heap_update(h, last);
+}
+
+/* Restore the heap order after the key of a task changed: O(log n) */
+void __hot_text heap_update(struct task_heap *h, struct task *t)
+{
+	sift_up(h, heap_pos(h, t));
+	sift_down(h, heap_pos(h, t));
+}
@@ -24,6 +24,10 @@ static void init_vectors(void)
 {
 	extern void _reset(void);
 	extern void _irq_handler(void);
+	extern void _undef_handler(void);
+#ifdef FIQ_TICK
+	extern void _fiq_handler(void);
+#endif
 	
 	volatile u32 *vectors = VECTOR_BASE;
 	
@@ -47,13 +51,17 @@ static void init_vectors(void)
 	vectors[7] = LDR_PC_PC;		/* FIQ */
 	
 	vectors[8] =  (u32) _reset;	/* Reset */
-	vectors[9] =  (u32) panic0;	/* Undefined Instruction */
+	vectors[9] =  (u32) _undef_handler;	/* Undefined Instruction */
 	vectors[10] = (u32) panic1;	/* Software Interrupt */
 	vectors[11] = (u32) panic2;	/* Prefetch Abort */
 	vectors[12] = (u32) panic3;	/* Data Abort */
 	vectors[13] = (u32) panic4;	/* Reserved */
 	vectors[14] = (u32) _irq_handler;	/* IRQ */
+#ifdef FIQ_TICK
+	vectors[15] = (u32) _fiq_handler;	/* FIQ */
+#else
 	vectors[15] = (u32) panic4;	/* FIQ */
+#endif
 	
 	/* Set base address of the exception vector (ARM manual p. 3-121) */
 	__asm__ __volatile__ ("mcr p15, 0, %[addr], c12, c0, 0" : : [addr] "r" (vectors));
@@ -77,7 +85,77 @@ static void init_vfp(void)
 	write_coprocessor_access_control_register(acr);
 	__memory_barrier();
 	
-	enable_vfp();
+	/* The VFP is enabled by the first VFP instruction of a task, that
+	 * takes the Undefined Instruction exception (see vfp.c) */
+	disable_vfp();
+}
+
+/* Enable L1 instruction and data caches and branch prediction */
+void init_caches(void)
+{
+	u32 cr;
+	
+	/* Cache contents are unpredictable after reset and the bootloader
+	 * may have left some dirty lines: write them back and start from
+	 * empty caches and an empty branch target cache. */
+	dcache_clean_invalidate_all();
+	icache_invalidate_all();
+	branch_target_cache_invalidate_all();
+	__synchronization_barrier();
+	
+	cr = read_control_register();
+	cr |= CR_ICACHE | CR_DCACHE | CR_BRANCH_PREDICTION;
+	write_control_register(cr);
+	
+	/* Next instructions must be fetched with the new configuration */
+	__flush_prefetch_buffer();
+	
+	/* Note that while the MMU is off the ARM1176 treats every data access
+	 * as Strongly Ordered: init_mmu() must run first, so that RAM is
+	 * cached and peripherals are not. */
+	
+#ifndef QEMU /* QEMU has no instruction cache to lock */
+	lock_hot_text();
+#endif
+}
+
+/* Load the .text.hot section in way 0 of the instruction cache and lock it.
+ * 
+ * While the lines are loaded only way 0 accepts new allocations, so every
+ * instruction fetched in the meantime ends up there as well. That's why
+ * this function is in .text.hot itself and calls no other function:
+ * whatever is fetched belongs to the locked region anyway.
+ * 
+ * Invalidating the entire instruction cache discards locked lines too,
+ * so call this function again after icache_invalidate_all(). */
+void __hot_text lock_hot_text(void)
+{
+	/* Defined in sert.lds, which also checks that they fit in one way */
+	extern char _hot_text_start, _hot_text_end;
+	unsigned long addr;
+	u32 flags;
+	
+	__asm__ __volatile__ ("mrs %[flags], cpsr\n\t"
+	                      "cpsid if" : [flags] "=r" (flags) : : "memory");
+	
+	/* Unlock everything and remove hot lines from other ways: a line
+	 * that hits in the cache would not be loaded again in way 0 */
+	write_icache_lockdown(CACHE_LOCKDOWN_SBO);
+	icache_invalidate_all(); /* Inline, not a call */
+	__flush_prefetch_buffer();
+	
+	/* Allocate only in way 0 */
+	write_icache_lockdown(CACHE_LOCKDOWN_SBO |
+	                      CACHE_LOCKDOWN_WAY(1) | CACHE_LOCKDOWN_WAY(2) | CACHE_LOCKDOWN_WAY(3));
+	for (addr = (unsigned long) &_hot_text_start; addr < (unsigned long) &_hot_text_end;
+	     addr += CACHE_LINE_SIZE)
+		icache_prefetch_line(addr);
+	
+	/* Lock way 0, the other ways are used as usual */
+	write_icache_lockdown(CACHE_LOCKDOWN_SBO | CACHE_LOCKDOWN_WAY(0));
+	__flush_prefetch_buffer();
+	
+	__asm__ __volatile__ ("msr cpsr_c, %[flags]" : : [flags] "r" (flags) : "memory");
 }
 
 /* Init to 0 section .bss, where static variables that
@@ -129,8 +207,13 @@ void _init(void)
 {
 	init_bss();
 	init_vectors();
+	init_gpio(); /* LED is needed if init_mmu() panics */
 	init_vfp();
-	init_gpio();
+	init_mmu(); /* Defined in mmu.c */
+#ifndef BENCHMARK
+	init_caches(); /* The benchmark build turns them on later (see bench.c) */
+#endif
+	init_pmu(); /* Defined in pmu.c */
 	
 #ifdef MINI_UART
 	init_miniuart(); /* Defined in uart.c */
@@ -139,6 +222,9 @@ void _init(void)
 #endif
 	
 	init_irq(); /* Defined in irq.c */
+#ifndef MINI_UART
+	init_uart_irq(); /* From now on UART0 output is sent by interrupts */
+#endif
 	init_ticks(); /* Defined in timer.c */
 	
 	init_taskset(); /* Defined in tasks.c */
@@ -146,7 +232,7 @@ void _init(void)
 	/* Create a task for the CBS server.
 	 * Maximum budget 25 unit time (ticks) per period
 	 * Period of 250 ticks. */
-	if (init_cbs(25, 250, &cbs0, "cbs0") == -1) /* Create a task for the CBS server */
+	if (init_cbs(25, 250, &cbs0, "cbs0") < 0) /* Create a task for the CBS server */
 		_panic(__FILE__, __LINE__, "Cannot create CBS server task.");
 	
 	/* Prevent code reordering (just in case) */
@@ -18,87 +18,156 @@
 
 #include "raspberry.h"
 
-/* These arrays are used to contain pointers to the functions that should be
- * called when a certain interrupt line become asserted. These functions
- * represent the high-level interrupt handler functions. */
-static isr_t ISR_IRQ1[IRQ_1_LINES];
-static isr_t ISR_IRQ2[IRQ_2_LINES];
-static isr_t ISR_BASIC_IRQ[IRQ_BASIC_LINES];
-
-/* This is a mid-level interrupt handler function */
-void _bsp_irq(void)
+/* This array contains pointers to the functions that should be called
+ * when a certain interrupt line become asserted. These functions represent
+ * the high-level interrupt handler functions.
+ * The lines of the three registers are flattened in a single table, in the
+ * same order of the Broadcom manual (and of the trace): GPU lines from 0
+ * to 63, then the ARM lines of the basic register. */
+#define IRQ_GPU_LINES (IRQ_1_LINES + IRQ_2_LINES)
+#define IRQ_LINES (IRQ_GPU_LINES + IRQ_BASIC_LINES)
+
+static isr_t ISR_IRQ[IRQ_LINES];
+
+/* GPU lines replicated in IRQ_BASIC_PENDING bits 10-20 (Broadcom manual
+ * p. 113). These "shortcut" lines are not reported by bits 8 and 9, so
+ * the most common sources (e.g. UART0, line 57) are served without reading
+ * IRQ_PENDING1 or IRQ_PENDING2 at all. */
+#define IRQ_BASIC_PENDING1 (1u << 8) /* Other lines asserted in IRQ_PENDING1 */
+#define IRQ_BASIC_PENDING2 (1u << 9) /* Other lines asserted in IRQ_PENDING2 */
+#define IRQ_BASIC_SHORTCUT_SHIFT 10
+#define IRQ_BASIC_SHORTCUT_MASK (0x7ffu << IRQ_BASIC_SHORTCUT_SHIFT)
+
+static const unsigned char IRQ_SHORTCUT[11] = {
+	7, 9, 10, 18, 19,           /* GPU IRQ 1 lines */
+	53, 54, 55, 56, 57, 62      /* GPU IRQ 2 lines */
+};
+
+/* Index of the least significant bit set in v (that must not be 0).
+ * ARMv6 has no "count trailing zeros" instruction: isolate the bit with
+ * v & -v and count the leading zeros instead. */
+static inline int irq_lowest_line(u32 v)
+{
+	return 31 - __builtin_clz(v & -v);
+}
+
+/* Call the high-level interrupt handler function of line n */
+static inline void irq_dispatch(int n)
+{
+	isr_t handler = ISR_IRQ[n];
+	struct trace_record saved;
+	u32 rec;
+	
+	if (!handler)
+		_panic(__FILE__, __LINE__, "No handler for the received IRQ.");
+	rec = trace_irq_entry(n, &saved);
+	handler();
+	trace_irq_exit(n, rec, &saved);
+	__synchronization_barrier();
+}
+
+/* Serve all the lines asserted in v, from the least significant bit.
+ * Each line costs a constant number of instructions, whatever its
+ * position in the register. */
+static inline void irq_dispatch_bank(u32 v, int base)
+{
+	while (v != 0) {
+		int i = irq_lowest_line(v);
+		
+		v &= v - 1; /* Clear the lowest bit set */
+		irq_dispatch(base + i);
+	}
+}
+
+/* This is a mid-level interrupt handler function. */
+void __hot_text _bsp_irq(void)
 {
-	isr_t handler;
-	int v, i;
+	u32 basic, v;
+#ifdef FIQ_TICK
+	/* _irq_handler left the FIQ enabled: the ISRs must not be
+	 * interrupted by the tick, as the rest of the C code (see
+	 * irq_disable()) */
+	irq_disable();
+#endif
+	PROFILE_BEGIN(PROFILE_IRQ);
 	
-	/* This Broadcom SoC does not support vectored interrupt,
-	 * so we must do all the work by hand */
+	/* This Broadcom SoC does not support vectored interrupt, so we must
+	 * do all the work by hand. IRQ_BASIC_PENDING summarizes the other two
+	 * registers, so it is the only one read when nothing else is pending. */
 	
 	/* While there's at least one IRQ line asserted (pending interrupt) */
-	while(iomem(IRQ_BASIC_PENDING) != 0 ||
-	      iomem(IRQ_PENDING1) != 0 ||
-	      iomem(IRQ_PENDING2) != 0) {
+	while ((basic = iomem(IRQ_BASIC_PENDING)) != 0) {
 		
-		/* Check basic IRQ register */
-		v = iomem(IRQ_BASIC_PENDING);
-		i = 0;
-		/* Shift until the asserted bit goes to the least
-		 * significant bit of the register */
-		while (v != 0) {
-			if (v & 1u) {
-				/* Call the high-level interrupt handler function related
-				 * to this interrupt (if set) */
-				handler = ISR_BASIC_IRQ[i];
-				if (!handler)
-					_panic(__FILE__, __LINE__, "No handler for the received IRQ.");
-				handler();
-				__synchronization_barrier();
-			}
-			v = v >> 1;
-			i++;
-		}
-		
-		/* Check GPU IRQ register 1 */
-		v = iomem(IRQ_PENDING1);
-		i = 0;
-		/* Shift until the asserted bit goes to the least
-		 * significant bit of the register */
-		while (v != 0) {
-			if (v & 1u) {
-				/* Call the high-level interrupt handler function related
-				 * to this interrupt (if set) */
-				handler = ISR_IRQ1[i];
-				if (!handler)
-					_panic(__FILE__, __LINE__, "No handler for the received IRQ.");
-				handler();
-				__synchronization_barrier();
-			}
-			v = v >> 1;
-			i++;
-		}
+		/* ARM lines of the basic register */
+		irq_dispatch_bank(basic & IRQ_BASIC_ARM_LINES_MASK, IRQ_GPU_LINES);
 		
-		/* Check GPU IRQ register 2 */
-		v = iomem(IRQ_PENDING2);
-		i = 0;
-		/* Shift until the asserted bit goes to the least
-		 * significant bit of the register */
+		/* GPU lines replicated in the basic register */
+		v = (basic & IRQ_BASIC_SHORTCUT_MASK) >> IRQ_BASIC_SHORTCUT_SHIFT;
 		while (v != 0) {
-			if (v & 1u) {
-				/* Call the high-level interrupt handler function related
-				 * to this interrupt (if set) */
-				handler = ISR_IRQ2[i];
-				if (!handler)
-					_panic(__FILE__, __LINE__, "No handler for the received IRQ.");
-				handler();
-				__synchronization_barrier();
-			}
-			v = v >> 1;
-			i++;
+			int i = irq_lowest_line(v);
+			
+			v &= v - 1;
+			irq_dispatch(IRQ_SHORTCUT[i]);
 		}
 		
+		/* Other GPU lines: read their register only if needed.
+		 * QEMU sets bits 8 and 9 for the shortcut lines as well, but
+		 * their handlers have already cleared them at this point. */
+		if (basic & IRQ_BASIC_PENDING1)
+			irq_dispatch_bank(iomem(IRQ_PENDING1), 0);
+		if (basic & IRQ_BASIC_PENDING2)
+			irq_dispatch_bank(iomem(IRQ_PENDING2), IRQ_1_LINES);
+	}
+	
+	PROFILE_END(PROFILE_IRQ);
+}
+
+#ifdef FIQ_TICK
+
+/* The FIQ is used for the tick only. The FIQ mode has banked r8-r12, so
+ * _fiq_handler (see irqhandler.S) saves just four registers before calling
+ * _bsp_fiq(), and runs the scheduler only if a job has been released.
+ * The FIQ needs its own stack: unlike the IRQ handler, it doesn't borrow
+ * the stack of the task, so it can return without touching it. */
+#define FIQ_STACK_SIZE 1024 /* Bytes */
+
+static u32 fiq_stack[FIQ_STACK_SIZE / 4] __attribute__((aligned(8)));
+static isr_t ISR_FIQ;
+static int fiq_source;
+
+/* This is the mid-level FIQ handler function */
+void __hot_text _bsp_fiq(void)
+{
+	struct trace_record saved;
+	u32 rec = trace_irq_entry(fiq_source, &saved);
+	
+	ISR_FIQ();
+	trace_irq_exit(fiq_source, rec, &saved);
+	__synchronization_barrier();
+}
+
+/* Route interrupt source n (see FIQ_SOURCE_GPU() and FIQ_SOURCE_BASIC())
+ * to the FIQ, served by func. The source must not be enabled as IRQ too.
+ * The FIQ is unmasked by the next irq_enable(). */
+int register_isr_fiq(int n, isr_t func)
+{
+	extern void _fiq_init_stack(u32 *top);
+	
+	if (n < 0 || n >= IRQ_LINES || ISR_FIQ != NULL) {
+		return 1;
 	}
+	
+	ISR_FIQ = func;
+	fiq_source = n;
+	_fiq_init_stack(fiq_stack + FIQ_STACK_SIZE / 4);
+	
+	iomem(IRQ_FIQ_CONTROL) = IRQ_FIQ_ENABLE | n;
+	
+	return 0;
 }
 
+#endif /* FIQ_TICK */
+
 /* Initialize all interrupts */
 void init_irq(void)
 {
@@ -106,6 +175,7 @@ void init_irq(void)
 	iomem(IRQ_DISABLE1) = 0xfffffffful;
 	iomem(IRQ_DISABLE2) = 0xfffffffful;
 	iomem(IRQ_BASIC_DISABLE) = 0xfffffffful;
+	iomem(IRQ_FIQ_CONTROL) = 0;
 	
 	/* Enable interrupts globally */
 	irq_enable();
@@ -114,11 +184,11 @@ void init_irq(void)
 /* Set a function as interrupt handler for the GPU IRQ 1 line n */
 int register_isr_irq1(int n, isr_t func)
 {
-	if (n > IRQ_1_LINES || ISR_IRQ1[n] != NULL) {
+	if (n < 0 || n >= IRQ_1_LINES || ISR_IRQ[n] != NULL) {
 		return 1;
 	}
 	
-	ISR_IRQ1[n] = func;
+	ISR_IRQ[n] = func;
 	
 	/* Enable line interrupt in GPU IRQ 1 register */
 	iomem_high(IRQ_ENABLE1, 1u << n);
@@ -129,11 +199,11 @@ int register_isr_irq1(int n, isr_t func)
 /* Set a function as interrupt handler for the GPU IRQ 2 line n */
 int register_isr_irq2(int n, isr_t func)
 {
-	if (n > IRQ_2_LINES || ISR_IRQ2[n] != NULL) {
+	if (n < 0 || n >= IRQ_2_LINES || ISR_IRQ[IRQ_1_LINES + n] != NULL) {
 		return 1;
 	}
 	
-	ISR_IRQ2[n] = func;
+	ISR_IRQ[IRQ_1_LINES + n] = func;
 	
 	/* Enable line interrupt in GPU IRQ 2 register */
 	iomem_high(IRQ_ENABLE2, 1u << n);
@@ -144,11 +214,11 @@ int register_isr_irq2(int n, isr_t func)
 /* Set a function as interrupt handler for the BASIC IRQ line n */
 int register_isr_irq_basic(int n, isr_t func)
 {
-	if (n > IRQ_BASIC_LINES || ISR_BASIC_IRQ[n] != NULL) {
+	if (n < 0 || n >= IRQ_BASIC_LINES || ISR_IRQ[IRQ_GPU_LINES + n] != NULL) {
 		return 1;
 	}
 	
-	ISR_BASIC_IRQ[n] = func;
+	ISR_IRQ[IRQ_GPU_LINES + n] = func;
 	
 	/* Enable line interrupt in IRQ BASIC register */
 	iomem_high(IRQ_BASIC_ENABLE, 1u << n);
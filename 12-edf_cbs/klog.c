@@ -0,0 +1,171 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Deferred log.
+ * 
+ * Printing a number from a job costs a division per digit and the
+ * transmission (or at least the copy) of every character, while the job
+ * is running. klog() (see common.h) only stores the address of the format
+ * string, the cycle counter and the raw arguments in a record of
+ * klog_ring: the message is formatted later by klog_flush(), that the
+ * idle task calls when no job is ready.
+ * 
+ * The format is a subset of printf(): %u, %d, %x, %c, %s and %%, without
+ * flags or widths. Strings printed with %s are read when the message is
+ * formatted, so they must not change in the meantime (string literals or
+ * task names).
+ * 
+ * With KLOG_BINARY ("make klog_binary") klog_flush() doesn't format the
+ * messages at all, it sends the records as lines
+ * 
+ *     @klog <hexadecimal bytes>
+ * 
+ * and tools/klog_decode.py formats them on the host, reading the format
+ * strings from sert.elf. The bytes are a little endian binary record:
+ * 
+ *     u32 magic "KLOG", u8 version, u8 number of records, u16 0
+ *     u32 frequency of the clock of the timestamps in Hz
+ *     u32 messages lost so far (ring full)
+ *     the records: u32 format address, u32 time, u32 args[KLOG_ARGS] */
+
+struct klog_record klog_ring[KLOG_RECORDS];
+volatile u32 klog_head = 0; /* Next record written by klog() */
+volatile u32 klog_tail = 0; /* Next record to print */
+volatile u32 klog_lost = 0; /* Messages dropped because the ring was full */
+
+#ifdef KLOG_BINARY
+
+#define KLOG_VERSION 1
+#define KLOG_LINE_RECORDS 8
+
+/* Send n records from klog_tail */
+static void klog_send(int n)
+{
+	const struct klog_record *r;
+	int i, j;
+	
+	puts("@klog ");
+	put_hex_le('K' | 'L' << 8 | 'O' << 16 | 'G' << 24, 4);
+	put_hex_le(KLOG_VERSION, 1);
+	put_hex_le(n, 1);
+	put_hex_le(0, 1);
+	put_hex_le(0, 1);
+	put_hex_le(CYCLE_COUNTER_HZ, 4);
+	put_hex_le(klog_lost, 4);
+	for (i = 0; i < n; ++i) {
+		r = &klog_ring[(klog_tail + i) & (KLOG_RECORDS - 1)];
+		put_hex_le(KLOG_ARG(r->fmt), 4);
+		put_hex_le(r->time, 4);
+		for (j = 0; j < KLOG_ARGS; ++j)
+			put_hex_le(r->args[j], 4);
+	}
+	puts("\n");
+}
+
+#else /* KLOG_BINARY */
+
+/* Format a message */
+static void klog_format(const struct klog_record *r)
+{
+	const char *f = r->fmt;
+	char hex[FMT_HEX_DIGITS + 1];
+	int arg = 0;
+	u32 v;
+	
+	for (; *f; ++f) {
+		if (*f != '%' || f[1] == '\0') {
+			putc(*f);
+			if (*f == '\n')
+				putc('\r'); /* As puts() does */
+			continue;
+		}
+		if (*++f == '%') {
+			putc('%');
+			continue;
+		}
+		v = arg < KLOG_ARGS ? r->args[arg++] : 0;
+		switch (*f) {
+		case 'u':
+			putu(v);
+			break;
+		case 'd':
+			putd((int) v);
+			break;
+		case 'x':
+			hex[FMT_HEX_DIGITS] = '\0';
+			puts(fmt_hex(hex + FMT_HEX_DIGITS, v, 1));
+			break;
+		case 'c':
+			putc(v);
+			break;
+		case 's':
+			puts((const char *)(unsigned long) v);
+			break;
+		default: /* Not supported: print it as it is */
+			putc('%');
+			putc(*f);
+		}
+	}
+}
+
+#endif /* KLOG_BINARY */
+
+/* Print at most max_records messages (or all of them if max_records is 0).
+ * There must be only one caller: the idle task (or _panic(), that
+ * never returns).
+ * Returns the number of messages printed. */
+int klog_flush(int max_records)
+{
+#ifndef KLOG_BINARY
+	static u32 reported; /* Value of klog_lost already printed */
+#endif
+	int sent = 0, n;
+	
+	for (;;) {
+		/* klog() doesn't overwrite records until klog_tail moves on,
+		 * so they can be read with IRQs enabled */
+		n = klog_head - klog_tail;
+		if (max_records && n > max_records - sent)
+			n = max_records - sent;
+		if (n == 0)
+			break;
+#ifdef KLOG_BINARY
+		if (n > KLOG_LINE_RECORDS)
+			n = KLOG_LINE_RECORDS;
+		klog_send(n);
+#else
+		n = 1;
+		klog_format(&klog_ring[klog_tail & (KLOG_RECORDS - 1)]);
+#endif
+		__memory_barrier(); /* Read the records before freeing them */
+		klog_tail += n;
+		sent += n;
+	}
+	
+#ifndef KLOG_BINARY
+	if (klog_lost != reported) {
+		reported = klog_lost;
+		puts("klog: ");
+		putu(reported);
+		puts(" messages lost\n");
+	}
+#endif
+	return sent;
+}
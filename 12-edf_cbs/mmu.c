@@ -0,0 +1,110 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Flat (virtual address == physical address) memory map built with
+ * 1MB sections, the whole 4GB address space is described by 4096 entries:
+ * 
+ *         +---------------+ 0xffffffff
+ *         |     FAULT     |
+ *         +---------------+ PERIPH_END (0x21000000)
+ *         |  peripherals  | Device, never executed
+ *         +---------------+ PERIPH_BASE (0x20000000)
+ *         |  GPU memory   | Normal, noncacheable
+ *         +---------------+ RAM_END (mem_end in sert.lds)
+ *         |      RAM      | Normal, write-back cacheable
+ *         +---------------+ 0x00000000
+ */
+
+/* These must agree with mem_end in sert.lds (checked by init_mmu()) */
+#define RAM_END ((512 - 64) * 1024 * 1024) /* 512MB of RAM excluding GPU memory */
+#define GPU_MEM_END (512 * 1024 * 1024)
+#define PERIPH_BASE 0x20000000
+#define PERIPH_END 0x21000000
+
+#define RAM_SECTIONS (RAM_END >> SECTION_SHIFT)
+#define GPU_MEM_SECTIONS (GPU_MEM_END >> SECTION_SHIFT)
+#define PERIPH_FIRST_SECTION (PERIPH_BASE >> SECTION_SHIFT)
+#define PERIPH_LAST_SECTION ((PERIPH_END >> SECTION_SHIFT) - 1)
+
+/* Attributes of section n */
+#define section_attr(n) \
+	((n) < RAM_SECTIONS ? SECTION_NORMAL_WBWA : \
+	 (n) < GPU_MEM_SECTIONS ? SECTION_NORMAL_UNCACHED : \
+	 (n) < PERIPH_FIRST_SECTION ? 0u : \
+	 (n) <= PERIPH_LAST_SECTION ? SECTION_DEVICE | SECTION_XN : 0u)
+
+/* Descriptor of section n (0 means translation fault) */
+#define SECTION(n) (section_attr(n) == 0u ? 0u : \
+	((u32)(n) << SECTION_SHIFT) | section_attr(n) | \
+	SECTION_AP_RW | SECTION_DOMAIN(0) | SECTION_TYPE)
+
+/* Each macro generates twice the entries of the previous one, so that
+ * the table is entirely computed by the compiler: there's no loop to
+ * run at boot time. */
+#define SECTIONS_2(n) SECTION(n), SECTION((n) + 1)
+#define SECTIONS_4(n) SECTIONS_2(n), SECTIONS_2((n) + 2)
+#define SECTIONS_8(n) SECTIONS_4(n), SECTIONS_4((n) + 4)
+#define SECTIONS_16(n) SECTIONS_8(n), SECTIONS_8((n) + 8)
+#define SECTIONS_32(n) SECTIONS_16(n), SECTIONS_16((n) + 16)
+#define SECTIONS_64(n) SECTIONS_32(n), SECTIONS_32((n) + 32)
+#define SECTIONS_128(n) SECTIONS_64(n), SECTIONS_64((n) + 64)
+#define SECTIONS_256(n) SECTIONS_128(n), SECTIONS_128((n) + 128)
+#define SECTIONS_512(n) SECTIONS_256(n), SECTIONS_256((n) + 256)
+#define SECTIONS_1024(n) SECTIONS_512(n), SECTIONS_512((n) + 512)
+#define SECTIONS_2048(n) SECTIONS_1024(n), SECTIONS_1024((n) + 1024)
+#define SECTIONS_4096(n) SECTIONS_2048(n), SECTIONS_2048((n) + 2048)
+
+#define TRANSLATION_TABLE_ENTRIES 4096
+
+/* The first level table must be aligned to 16KB (ARM manual p. 6-37).
+ * Being const it is written in .rodata together with the program. */
+static const u32 translation_table[TRANSLATION_TABLE_ENTRIES]
+		__attribute__((aligned(TRANSLATION_TABLE_ENTRIES * sizeof(u32)))) = {
+	SECTIONS_4096(0)
+};
+
+/* Enable the MMU with the translation table above */
+void init_mmu(void)
+{
+	/* mem_end is defined in sert.lds: its address is its value */
+	extern u32 mem_end;
+	u32 cr;
+	
+	if ((u32) &mem_end > RAM_END)
+		_panic(__FILE__, __LINE__, "RAM in sert.lds exceeds the cacheable sections.");
+	
+	/* Domain 0 is the only one used: check accesses against AP bits */
+	write_domain_access_control_register(DOMAIN_CLIENT(0));
+	
+	/* Use TTBR0 for the whole address space */
+	write_ttbcr(0u);
+	write_ttbr0((u32) translation_table | TTBR_INNER_CACHEABLE);
+	
+	tlb_invalidate_all();
+	__synchronization_barrier();
+	
+	cr = read_control_register();
+	cr |= CR_MMU | CR_XP;
+	write_control_register(cr);
+	
+	/* Addresses are the same before and after, so we can
+	 * continue to execute from the next instruction */
+	__flush_prefetch_buffer();
+}
@@ -27,12 +27,22 @@
 inline void _panic(const char *file, int line, const char *msg)
 {
 	irq_disable();
+#ifndef MINI_UART
+	uart_sync(); /* No more interrupts: send the buffered output by polling */
+#endif
 	puts("\n\nPANIC!\n");
 	puts(file);
 	puts(":");
 	putd(line);
 	puts(": ");
 	puts(msg);
+	if (klog_head != klog_tail) {
+		puts("\nLast messages:\n");
+		klog_flush(0);
+	}
+#ifdef TRACE_DRAIN
+	trace_flush(0); /* The events that led here */
+#endif
 	for(;;) {
 		LED_ON
 		loop_delay(5000000u);
@@ -0,0 +1,132 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Performance monitor of the ARM1176.
+ * The cycle counter counts core clock cycles, count registers 0 and 1
+ * are programmed to count instruction cache misses and mispredicted
+ * branches. All of them are free running: a region is measured by the
+ * difference of two snapshots (see PROFILE_BEGIN/PROFILE_END in common.h). */
+
+struct profile_entry {
+	u32 count;                            /* Times the region was executed */
+	u32 min_cycles;
+	u32 max_cycles;
+	unsigned long long cycles;            /* Totals since last reset */
+	unsigned long long icache_misses;
+	unsigned long long branch_mispredicts;
+};
+
+static struct profile_entry profile_table[PROFILE_NUM_REGIONS];
+
+static const char * const profile_names[PROFILE_NUM_REGIONS] = {
+	[PROFILE_IRQ] = "irq",
+	[PROFILE_TICK] = "tick",
+	[PROFILE_SCHEDULE] = "schedule",
+};
+
+void init_pmu(void)
+{
+	enable_pmu(PMU_EVT_ICACHE_MISS, PMU_EVT_BRANCH_MISPREDICTED);
+	profile_reset();
+}
+
+/* Add the counters elapsed since begin to the entry of region r */
+void profile_record(enum profile_region r, const struct pmu_sample *begin)
+{
+	struct pmu_sample end;
+	struct profile_entry *e = &profile_table[r];
+	unsigned long flags;
+	u32 c;
+	
+	pmu_read(&end);
+	c = end.cycles - begin->cycles;
+	
+	/* The same region can be entered again by an IRQ handler */
+	irq_save(flags);
+	e->count++;
+	e->cycles += c;
+	e->icache_misses += end.icache_misses - begin->icache_misses;
+	e->branch_mispredicts += end.branch_mispredicts - begin->branch_mispredicts;
+	if (c < e->min_cycles)
+		e->min_cycles = c;
+	if (c > e->max_cycles)
+		e->max_cycles = c;
+	irq_restore(flags);
+}
+
+void profile_reset(void)
+{
+	struct profile_entry *e;
+	unsigned long flags;
+	
+	irq_save(flags);
+	for (e = profile_table; e < profile_table + PROFILE_NUM_REGIONS; ++e) {
+		e->count = 0;
+		e->min_cycles = MAXUINT;
+		e->max_cycles = 0;
+		e->cycles = 0;
+		e->icache_misses = 0;
+		e->branch_mispredicts = 0;
+	}
+	irq_restore(flags);
+}
+
+/* Average of a total over count executions */
+static u32 profile_avg(unsigned long long total, u32 count)
+{
+	udiv64(&total, count);
+	return (u32) total;
+}
+
+/* Print the table on the serial line:
+ *     profile: <region> n=<count> cycles=<min>/<avg>/<max> icache_miss=<avg> mispredict=<avg> */
+void profile_dump(void)
+{
+	struct profile_entry e;
+	unsigned long flags;
+	int r;
+	
+	for (r = 0; r < PROFILE_NUM_REGIONS; ++r) {
+		/* Take a consistent copy, printing is slow */
+		irq_save(flags);
+		e = profile_table[r];
+		irq_restore(flags);
+		
+		puts("profile: ");
+		puts(profile_names[r]);
+		puts(" n=");
+		putu(e.count);
+		if (e.count == 0) {
+			puts("\n");
+			continue;
+		}
+		puts(" cycles=");
+		putu(e.min_cycles);
+		puts("/");
+		putu(profile_avg(e.cycles, e.count));
+		puts("/");
+		putu(e.max_cycles);
+		puts(" icache_miss=");
+		putu(profile_avg(e.icache_misses, e.count));
+		puts(" mispredict=");
+		putu(profile_avg(e.branch_mispredicts, e.count));
+		puts("\n");
+	}
+}
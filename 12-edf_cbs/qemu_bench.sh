@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# Raspberry Bare Metal
+# Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+# 
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Run the benchmarks of bench.c in QEMU and collect the "@bench" lines.
+#
+# QEMU does not emulate the ARM timer and the performance monitor of the
+# ARM1176, so the QEMU build uses the System Timer for the tick and for
+# the measures (microseconds). With -icount the virtual clock advances
+# with the executed instructions: the numbers are the same at every run
+# and do not depend on the load of the host, so they can be compared
+# with a baseline to catch regressions.
+
+usage() {
+	echo "Usage: $0 [-M machine] [-s shift] [-o file] [-b baseline] [-t tolerance]"
+	echo "  -M  QEMU machine (default raspi0, also raspi1ap)"
+	echo "  -s  icount shift: 2^shift ns per instruction (default 7)"
+	echo "  -o  write the results to file (default stdout)"
+	echo "  -b  compare the averages with a previous results file"
+	echo "  -t  max slowdown in percent allowed by -b (default 10)"
+	echo "  -T  seconds before giving up (default 120)"
+	exit 2
+}
+
+MACHINE=raspi0
+SHIFT=7
+OUTPUT=
+BASELINE=
+TOLERANCE=10
+TIMEOUT=120
+QEMU=${QEMU:-qemu-system-arm}
+
+while getopts "M:s:o:b:t:T:h" opt; do
+	case $opt in
+	M) MACHINE=$OPTARG ;;
+	s) SHIFT=$OPTARG ;;
+	o) OUTPUT=$OPTARG ;;
+	b) BASELINE=$OPTARG ;;
+	t) TOLERANCE=$OPTARG ;;
+	T) TIMEOUT=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+cd "$(dirname "$0")" || exit 1
+
+make clean > /dev/null && make qemu_benchmark > /dev/null || {
+	echo "$0: build failed" >&2
+	exit 1
+}
+
+RESULTS=$(mktemp) || exit 1
+trap 'rm -f "$RESULTS"' EXIT
+
+echo "@bench machine=$MACHINE icount_shift=$SHIFT" > "$RESULTS"
+
+# The program never ends: stop reading the console after "@bench end"
+timeout "$TIMEOUT" "$QEMU" -M "$MACHINE" -kernel sert.elf \
+		-display none -monitor none -serial stdio \
+		-icount shift="$SHIFT" 2> /dev/null \
+	| tr -d '\r' \
+	| sed -n '/^@bench begin/,/^@bench end/{p;/^@bench end/q;}' >> "$RESULTS"
+
+if ! grep -q '^@bench end' "$RESULTS"; then
+	echo "$0: benchmarks did not complete" >&2
+	exit 1
+fi
+
+if [ -n "$OUTPUT" ]; then
+	cp "$RESULTS" "$OUTPUT"
+else
+	grep '^@bench name=' "$RESULTS"
+fi
+
+[ -z "$BASELINE" ] && exit 0
+
+# A benchmark is identified by all its fields except the measures.
+# Compare the averages and fail if one grew more than TOLERANCE percent.
+awk -v tol="$TOLERANCE" '
+function key(   i, k) {
+	k = ""
+	for (i = 2; i <= NF; ++i)
+		if ($i !~ /^(n|min|avg|max)=/)
+			k = k " " $i
+	return k
+}
+function avg(   i) {
+	for (i = 2; i <= NF; ++i)
+		if ($i ~ /^avg=/)
+			return substr($i, 5) + 0
+	return 0
+}
+$1 != "@bench" || $2 !~ /^name=/ { next }
+FNR == NR { base[key()] = avg(); next }
+{
+	k = key()
+	if (!(k in base))
+		next
+	a = avg()
+	if (a > base[k] * (100 + tol) / 100) {
+		printf "REGRESSION%s: avg %d -> %d\n", k, base[k], a
+		bad = 1
+	}
+}
+END { exit bad }
+' "$BASELINE" "$RESULTS"
@@ -21,13 +21,6 @@
 
 typedef unsigned int u32;
 
-/* _iomem is a address that will be used as base address of the memory.
- * It is important to set as 0 because compiler can make optimizations when
- * accessing to an offset of this, because the sum of a number with
- * zero is always the number itself. This prevents to load the constant
- * value from memory. See also the iomem(N) definition below. */
-static volatile u32 * const _iomem = (u32*) 0;
-
 /* iomemdef generates new constants called as parameter N, the first argument
  * of the macro call, and value as parameter V, the second argument.
  * This macro is useful in order to define memory address at runtime as constants
@@ -35,12 +28,28 @@ static volatile u32 * const _iomem = (u32*) 0;
  * value from the RAM. */
 #define iomemdef(N, V) enum { N = (V) / sizeof(u32) }
 
+#ifdef HOST_SIM
+/* Host simulation: replaces iomem() and the CPU primitives. It comes before
+ * iomem_high() and iomem_low(), that must use the host iomem() too. */
+#include "sim/host.h"
+#else
+
+/* _iomem is a address that will be used as base address of the memory.
+ * It is important to set as 0 because compiler can make optimizations when
+ * accessing to an offset of this, because the sum of a number with
+ * zero is always the number itself. This prevents to load the constant
+ * value from memory. See also the iomem(N) definition below. */
+static volatile u32 * const _iomem = (u32*) 0;
+
 /* iomem(N) is used to access address N as if it was a function, but it has the benefit
  * of avoiding RAM accesses to fetch addresses. In fact N is a constant defined by
  * iomemdef and does not require a memory access to get its value, moreover the
  * _iomem + N sum is optimized by the compiler in N because _iomem is 0. */
 #define iomem(N) _iomem[N]
 
+#include "raspberry_cpu.h"
+#endif /* HOST_SIM */
+
 /* Set to 1 all bits of register reg that are marked as 1 in the mask */
 static inline void iomem_high(unsigned int reg, u32 mask)
 {
@@ -53,12 +62,12 @@ static inline void iomem_low(unsigned int reg, u32 mask)
 	iomem(reg) &= ~mask;
 }
 
-#include "raspberry_cpu.h"
 #include "raspberry_gpio.h"
 #include "raspberry_led.h"
 #include "raspberry_uart.h"
 #include "raspberry_irq.h"
 #include "raspberry_timer.h"
+#include "raspberry_dma.h"
 #include "common.h"
 
 #endif
@@ -115,6 +115,8 @@
 
 /* FPEXC: Floating Point Exception Register (ARM manual p. 20-16) */
 /* 30-th bit (0x40000000) of FPEXC register enables the VFP */
+#define FPEXC_EN 0x40000000u
+
 #define enable_vfp() do { \
 	int dummy; \
 	__asm__ __volatile__ ("fmrx %0,fpexc\n\t" \
@@ -122,6 +124,307 @@
 						  "fmxr fpexc,%0" : "=r" (dummy) : : ); \
 } while(0)
 
+/* With the VFP disabled every VFP instruction (but the access to FPEXC
+ * and FPSID) raises an Undefined Instruction exception */
+#define disable_vfp() do { \
+	int dummy; \
+	__asm__ __volatile__ ("fmrx %0,fpexc\n\t" \
+						  "bic %0,%0,#0x40000000\n\t" \
+						  "fmxr fpexc,%0" : "=r" (dummy) : : ); \
+} while(0)
+
+#define read_fpexc() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("fmrx %[reg],fpexc" : [reg] "=r" (value) : : ); \
+	value; })
+
+
+
+/* ~~~~~~~~~~~~ CACHES ~~~~~~~~~~~~ */
+
+/* Control Register (ARM manual p. 3-44) */
+#define read_control_register() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("mrc p15, 0, %[reg], c1, c0, 0" : [reg] "=r" (value) : : "memory"); \
+	value; })
+
+#define write_control_register(value) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c1, c0, 0" : : [reg] "r" (value) : "memory")
+
+#define CR_MMU (1u<<0)                /* M: MMU enable */
+#define CR_DCACHE (1u<<2)             /* C: L1 data cache enable */
+#define CR_BRANCH_PREDICTION (1u<<11) /* Z: program flow prediction enable */
+#define CR_ICACHE (1u<<12)            /* I: L1 instruction cache enable */
+#define CR_XP (1u<<23)                /* XP: ARMv6 page table format (subpages disabled) */
+
+/* Cache state as seen by the rest of the program */
+#define icache_enabled() ((read_control_register() & CR_ICACHE) != 0)
+#define dcache_enabled() ((read_control_register() & CR_DCACHE) != 0)
+#define branch_prediction_enabled() ((read_control_register() & CR_BRANCH_PREDICTION) != 0)
+
+/* Cache operations, c7 (ARM manual p. 3-69).
+ * "Entire cache" operations ignore the value of the register, so we pass
+ * [dummy] as done for the barriers above. */
+
+/* Clean (write back dirty lines) entire data cache */
+#define dcache_clean_all() __asm__ __volatile__ ("mcr p15, 0, %[dummy], c7, c10, 0" : : [dummy] "r" (0) : "memory")
+
+/* Clean (write back dirty lines) and invalidate entire data cache */
+#define dcache_clean_invalidate_all() __asm__ __volatile__ ("mcr p15, 0, %[dummy], c7, c14, 0" : : [dummy] "r" (0) : "memory")
+
+/* Flush entire branch target cache */
+#define branch_target_cache_invalidate_all() __asm__ __volatile__ ("mcr p15, 0, %[dummy], c7, c5, 6" : : [dummy] "r" (0) : "memory")
+
+/* Flush Prefetch Buffer (ARM manual p. 3-79).
+ * Instructions after this one are fetched again, so they see the
+ * effects of a change to the Control Register or to the caches. */
+#define __flush_prefetch_buffer() __asm__ __volatile__ ("mcr p15, 0, %[dummy], c7, c5, 4" : : [dummy] "r" (0) : "memory")
+
+/* Invalidate entire instruction cache.
+ * ARM1176 erratum 411920: the operation can fail to invalidate some lines.
+ * The workaround is to repeat it four times with interrupts disabled and
+ * to follow it with 11 NOPs (the same sequence used by Linux). */
+static inline void icache_invalidate_all(void)
+{
+	u32 flags;
+	
+	__asm__ __volatile__ ("mrs %[flags], cpsr\n\t"
+	                      "cpsid ifa\n\t"
+	                      "mcr p15, 0, %[dummy], c7, c5, 0\n\t"
+	                      "mcr p15, 0, %[dummy], c7, c5, 0\n\t"
+	                      "mcr p15, 0, %[dummy], c7, c5, 0\n\t"
+	                      "mcr p15, 0, %[dummy], c7, c5, 0\n\t"
+	                      "msr cpsr_cx, %[flags]\n\t"
+	                      "nop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\t"
+	                      "nop\n\tnop\n\tnop\n\tnop\n\tnop"
+	                      : [flags] "=&r" (flags) : [dummy] "r" (0) : "memory");
+}
+
+/* Cache operations on a single line, by Modified Virtual Address.
+ * The MMU maps memory 1:1, so MVA is just the address of the data. */
+#define CACHE_LINE_SIZE 32 /* Bytes, for both L1 caches of the ARM1176 */
+
+#define dcache_clean_line(addr) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c7, c10, 1" : : [reg] "r" (addr) : "memory")
+#define dcache_invalidate_line(addr) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c7, c6, 1" : : [reg] "r" (addr) : "memory")
+#define dcache_clean_invalidate_line(addr) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c7, c14, 1" : : [reg] "r" (addr) : "memory")
+#define icache_invalidate_line(addr) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c7, c5, 1" : : [reg] "r" (addr) : "memory")
+
+/* Cache operations on a range of addresses.
+ * 
+ * They must be used by drivers that share buffers with a bus master
+ * other than the CPU (e.g. the DMA controller):
+ *   - dcache_clean_range() before the device reads a buffer written by the CPU;
+ *   - dcache_invalidate_range() before the CPU reads a buffer written by the device;
+ *   - dcache_clean_invalidate_range() for buffers read and written by both;
+ *   - icache_invalidate_range() after writing instructions in memory.
+ * 
+ * Every line that intersects [start, start + size) is affected, so the
+ * cost grows linearly with size (see the cache benchmark in bench.c):
+ * for large buffers the "entire cache" operations above can be cheaper. */
+
+#define cache_line_start(p) ((unsigned long)(p) & ~(unsigned long)(CACHE_LINE_SIZE - 1))
+
+static inline void dcache_clean_range(const void *start, unsigned long size)
+{
+	unsigned long addr = cache_line_start(start);
+	unsigned long end = (unsigned long) start + size;
+	
+	for (; addr < end; addr += CACHE_LINE_SIZE)
+		dcache_clean_line(addr);
+	/* Wait until the write buffer is empty: now memory is up to date */
+	__synchronization_barrier();
+}
+
+static inline void dcache_invalidate_range(const void *start, unsigned long size)
+{
+	unsigned long addr = cache_line_start(start);
+	unsigned long end = (unsigned long) start + size;
+	
+	/* The first and the last line may contain other data than the buffer:
+	 * write it back before throwing the line away */
+	if (addr != (unsigned long) start)
+		dcache_clean_invalidate_line(addr);
+	if (end & (CACHE_LINE_SIZE - 1))
+		dcache_clean_invalidate_line(cache_line_start(end));
+	
+	for (; addr < end; addr += CACHE_LINE_SIZE)
+		dcache_invalidate_line(addr);
+	__synchronization_barrier();
+}
+
+static inline void dcache_clean_invalidate_range(const void *start, unsigned long size)
+{
+	unsigned long addr = cache_line_start(start);
+	unsigned long end = (unsigned long) start + size;
+	
+	for (; addr < end; addr += CACHE_LINE_SIZE)
+		dcache_clean_invalidate_line(addr);
+	__synchronization_barrier();
+}
+
+static inline void icache_invalidate_range(const void *start, unsigned long size)
+{
+	unsigned long addr = cache_line_start(start);
+	unsigned long end = (unsigned long) start + size;
+	
+	/* New instructions must have reached memory before fetching them */
+	dcache_clean_range(start, size);
+	for (; addr < end; addr += CACHE_LINE_SIZE)
+		icache_invalidate_line(addr);
+	branch_target_cache_invalidate_all();
+	__synchronization_barrier();
+	__flush_prefetch_buffer();
+}
+
+
+
+/* Cache lockdown (ARM manual p. 3-89).
+ * The instruction cache is 4-way set associative: each bit of the
+ * lockdown register prevents the allocation of new lines in one way, so
+ * lines already there can never be evicted. Bits [31:4] should be one. */
+#define read_icache_lockdown() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("mrc p15, 0, %[reg], c9, c0, 1" : [reg] "=r" (value) : : "memory"); \
+	value; })
+
+#define write_icache_lockdown(value) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c9, c0, 1" : : [reg] "r" (value) : "memory")
+
+#define ICACHE_WAYS 4
+#define ICACHE_WAY_SIZE 4096 /* 16KB instruction cache */
+#define CACHE_LOCKDOWN_SBO 0xfffffff0u
+#define CACHE_LOCKDOWN_WAY(n) (1u<<(n))
+
+/* Prefetch instruction cache line (ARM manual p. 3-75): load the line
+ * that contains addr in the instruction cache without executing it */
+#define icache_prefetch_line(addr) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c7, c13, 1" : : [reg] "r" (addr) : "memory")
+
+
+
+/* ~~~~~~~~~~~~~ MMU ~~~~~~~~~~~~~~ */
+
+/* First level descriptor for a 1MB section, ARMv6 format (ARM manual p. 6-39).
+ *
+ *  31          20 19 18 17 16 15 14 12 11 10 9 8    5 4  3 2 1 0
+ * +--------------+--+--+--+--+--+-----+-----+-+------+--+-+-+---+
+ * | base address |0 |0 |nG|S |APX| TEX | AP  |P|domain|XN|C|B|1 0|
+ * +--------------+--+--+--+--+--+-----+-----+-+------+--+-+-+---+
+ *
+ * A descriptor equal to 0 is a translation fault. */
+#define SECTION_SHIFT 20
+#define SECTION_SIZE (1u<<SECTION_SHIFT)
+#define SECTION_TYPE (2u)              /* bits[1:0] = 0b10 */
+#define SECTION_B (1u<<2)
+#define SECTION_C (1u<<3)
+#define SECTION_XN (1u<<4)             /* Execute Never */
+#define SECTION_DOMAIN(d) ((d)<<5)
+#define SECTION_AP_RW (3u<<10)         /* Read/write access in every mode */
+#define SECTION_TEX(t) ((t)<<12)
+#define SECTION_SHARED (1u<<16)
+
+/* Memory types (ARM manual p. 6-15). Note that the ARM1176 does not cache
+ * Shared Normal memory, so RAM must not be marked as shared. */
+#define SECTION_NORMAL_WBWA (SECTION_TEX(1) | SECTION_C | SECTION_B) /* Write-back, write-allocate */
+#define SECTION_NORMAL_UNCACHED (SECTION_TEX(1))                     /* Normal, noncacheable */
+#define SECTION_DEVICE (SECTION_B | SECTION_SHARED)                  /* Shared device */
+#define SECTION_STRONGLY_ORDERED (0u)
+
+/* Translation Table Base Register 0 (ARM manual p. 3-57) */
+#define write_ttbr0(value) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c2, c0, 0" : : [reg] "r" (value) : "memory")
+
+#define TTBR_INNER_CACHEABLE (1u<<0) /* Page table walks go through the L1 data cache */
+
+/* Translation Table Base Control Register (ARM manual p. 3-61) */
+#define write_ttbcr(value) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c2, c0, 2" : : [reg] "r" (value) : "memory")
+
+/* Domain Access Control Register (ARM manual p. 3-63) */
+#define write_domain_access_control_register(value) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c3, c0, 0" : : [reg] "r" (value) : "memory")
+
+#define DOMAIN_CLIENT(d) (1u<<((d)*2)) /* Accesses are checked against the descriptor permissions */
+
+/* Invalidate entire unified TLB (ARM manual p. 3-86) */
+#define tlb_invalidate_all() __asm__ __volatile__ ("mcr p15, 0, %[dummy], c8, c7, 0" : : [dummy] "r" (0) : "memory")
+
+
+
+/* ~~~~~~ PERFORMANCE MONITOR ~~~~~~ */
+
+/* Performance Monitor Control Register (ARM manual p. 3-133) */
+#define read_pmnc() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("mrc p15, 0, %[reg], c15, c12, 0" : [reg] "=r" (value) : : "memory"); \
+	value; })
+
+#define write_pmnc(value) \
+	__asm__ __volatile__ ("mcr p15, 0, %[reg], c15, c12, 0" : : [reg] "r" (value) : "memory")
+
+#define PMNC_ENABLE (1u<<0)     /* E: enable all counters */
+#define PMNC_RESET_COUNT (1u<<1) /* P: reset count registers 0 and 1 */
+#define PMNC_RESET_CCNT (1u<<2) /* C: reset the cycle counter */
+#define PMNC_EVT_COUNT1(e) ((u32)(e)<<12) /* Event counted by Count Register 1 */
+#define PMNC_EVT_COUNT0(e) ((u32)(e)<<20) /* Event counted by Count Register 0 */
+
+/* Events that Count Registers 0 and 1 can count (ARM manual p. 3-135) */
+#define PMU_EVT_ICACHE_MISS 0x00
+#define PMU_EVT_BRANCH_EXECUTED 0x05
+#define PMU_EVT_BRANCH_MISPREDICTED 0x06
+#define PMU_EVT_INSTRUCTION_EXECUTED 0x07
+#define PMU_EVT_DCACHE_ACCESS 0x0a
+#define PMU_EVT_DCACHE_MISS 0x0b
+#define PMU_EVT_DCACHE_WRITEBACK 0x0c
+#define PMU_EVT_MAIN_TLB_MISS 0x0f
+#define PMU_EVT_CYCLES 0xff
+
+#ifdef QEMU
+
+/* QEMU does not emulate the performance monitor of the ARM1176 (its
+ * registers read as zero), so the QEMU build ("make qemu") measures time
+ * with the 1MHz counter of the System Timer (see raspberry_timer.h).
+ * Differences of read_cycle_counter() are in microseconds of virtual time. */
+#define read_cycle_counter() ((u32)iomem(SYSTIMER_CLO))
+#define CYCLE_COUNTER_HZ 1000000u
+#define read_pmn0() (0u)
+#define read_pmn1() (0u)
+#define enable_pmu(evt0, evt1) do { } while (0)
+
+#else
+
+/* Cycle Counter Register (ARM manual p. 3-138).
+ * It is incremented at every core clock cycle and wraps at 2^32,
+ * so differences between two readings are always correct if the
+ * measured interval is shorter than about 6 seconds at 700MHz. */
+#define read_cycle_counter() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("mrc p15, 0, %[reg], c15, c12, 1" : [reg] "=r" (value) : : "memory"); \
+	value; })
+#define CYCLE_COUNTER_HZ 700000000u /* Default core clock of the firmware */
+
+/* Count Register 0 and 1 (ARM manual p. 3-139) */
+#define read_pmn0() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("mrc p15, 0, %[reg], c15, c12, 2" : [reg] "=r" (value) : : "memory"); \
+	value; })
+
+#define read_pmn1() ({ \
+	u32 value; \
+	__asm__ __volatile__ ("mrc p15, 0, %[reg], c15, c12, 3" : [reg] "=r" (value) : : "memory"); \
+	value; })
+
+/* Reset and start the cycle counter and the two count registers */
+#define enable_pmu(evt0, evt1) write_pmnc(PMNC_ENABLE | PMNC_RESET_CCNT | PMNC_RESET_COUNT | \
+                                          PMNC_EVT_COUNT0(evt0) | PMNC_EVT_COUNT1(evt1))
+
+#endif /* QEMU */
+
+
 
 
 /* ~~~~~~~~~~~~~ WFI ~~~~~~~~~~~~~~ */
@@ -129,3 +432,11 @@
 /* Wait For Interrupt (ARM manual p. 3-85)
  * Put the processor into low power state until an interrupt event occurs */
 #define __wfi() __asm__ __volatile__ ("mcr p15, 0, %[dummy], c7, c0, 4" : : [dummy] "r" (0) : "memory")
+
+
+
+/* ~~~~~~~~~~~ FUNCTIONS ~~~~~~~~~~ */
+
+/* The compiler generates no prologue and no epilogue for a naked function:
+ * it is used by the functions that switch the stack */
+#define __naked __attribute__((naked))
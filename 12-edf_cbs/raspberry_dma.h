@@ -0,0 +1,91 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RASPBERRY_H
+#error You should not include sub-header files
+#endif
+
+/* DMA CONTROLLER DEFINITIONS */
+
+/* Chapter 4 of the Broadcom SoC manual (page 38) */
+#define DMA_BASE 0x20007000
+
+/* Channels 0-14 have the same registers, 0x100 bytes apart.
+ * Use them as iomem(DMA_CS(ch)). */
+#define DMA_CHANNEL_BASE(ch) (DMA_BASE + (ch) * 0x100)
+#define DMA_CS(ch) ((DMA_CHANNEL_BASE(ch) + 0x0) / sizeof(u32)) /* Control and Status */
+#define DMA_CONBLK_AD(ch) ((DMA_CHANNEL_BASE(ch) + 0x4) / sizeof(u32)) /* Control Block Address */
+#define DMA_TXFR_LEN(ch) ((DMA_CHANNEL_BASE(ch) + 0x14) / sizeof(u32)) /* Bytes left in the current block */
+#define DMA_DEBUG(ch) ((DMA_CHANNEL_BASE(ch) + 0x20) / sizeof(u32)) /* Debug (error flags) */
+
+iomemdef(DMA_INT_STATUS, DMA_BASE + 0xfe0); /* Interrupt status of each channel */
+iomemdef(DMA_ENABLE, DMA_BASE + 0xff0); /* Global enable bits for each channel */
+
+/* Channel n is wired to the GPU IRQ 16 + n, that is line 16 + n
+ * of GPU IRQ 1 (page 113) */
+#define DMA_IRQ_LINE(ch) (16 + (ch))
+
+/* CS register (page 47) */
+#define DMA_CS_ACTIVE (1u) /* Set to 1 to start the channel, 0 when it has finished */
+#define DMA_CS_END (1u<<1) /* Set when a transfer completes, write 1 to clear */
+#define DMA_CS_INT (1u<<2) /* Interrupt status, write 1 to clear */
+#define DMA_CS_ERROR (1u<<8) /* The channel stopped because of an error (see DEBUG) */
+#define DMA_CS_PRIORITY(p) ((u32)(p)<<16) /* bits 19-16: AXI priority */
+#define DMA_CS_PANIC_PRIORITY(p) ((u32)(p)<<20) /* bits 23-20: AXI panic priority */
+#define DMA_CS_WAIT_FOR_OUTSTANDING_WRITES (1u<<28) /* END only when the last write has been acknowledged */
+#define DMA_CS_ABORT (1u<<30) /* Abort the current control block */
+#define DMA_CS_RESET (1u<<31) /* Reset the channel */
+
+/* DEBUG register (page 55): write 1 to clear these errors */
+#define DMA_DEBUG_ERRORS 7u /* READ_ERROR, FIFO_ERROR, READ_LAST_NOT_SET_ERROR */
+
+/* TI field of the control block (page 50) */
+#define DMA_TI_INTEN (1u) /* Raise an interrupt when this control block completes */
+#define DMA_TI_WAIT_RESP (1u<<3) /* Wait the AXI write response after each write */
+#define DMA_TI_DEST_INC (1u<<4) /* Increment the destination address */
+#define DMA_TI_DEST_DREQ (1u<<6) /* Pace the writes with the DREQ of the peripheral */
+#define DMA_TI_SRC_INC (1u<<8) /* Increment the source address */
+#define DMA_TI_SRC_DREQ (1u<<10) /* Pace the reads with the DREQ of the peripheral */
+#define DMA_TI_PERMAP(p) ((u32)(p)<<16) /* bits 20-16: peripheral that paces the transfer */
+
+/* Peripheral numbers for DMA_TI_PERMAP (page 61) */
+#define DMA_PERMAP_UART_TX 12
+#define DMA_PERMAP_UART_RX 14
+
+/* The DMA controller doesn't see the ARM physical addresses, but the
+ * VideoCore bus addresses (page 5-6):
+ *   - peripherals are at 0x7e000000 instead of 0x20000000;
+ *   - RAM is replicated 4 times with different VideoCore L2 cache
+ *     policies. The ARM goes through the L2 cache (alias 0x40000000),
+ *     so the DMA must use the same alias to see the same data. */
+#define DMA_BUS_PERIPH(addr) ((u32)(addr) - 0x20000000 + 0x7e000000)
+#define DMA_BUS_RAM(addr) ((u32)(addr) | 0x40000000)
+
+/* Control block: tells the channel what to transfer (page 40).
+ * Blocks are chained by nextconbk, 0 means the last one.
+ * It must be aligned to 256 bits and it is read by the DMA controller
+ * from memory, so it must be cleaned from the data cache (see dma_start()). */
+struct dma_cb {
+	u32 ti;        /* Transfer information (DMA_TI_*) */
+	u32 source_ad; /* Bus address of the source */
+	u32 dest_ad;   /* Bus address of the destination */
+	u32 txfr_len;  /* Bytes to transfer */
+	u32 stride;    /* Unused (2D mode) */
+	u32 nextconbk; /* Bus address of the next control block, 0 to stop */
+	u32 reserved[2];
+} __attribute__((aligned(32)));
@@ -20,7 +20,7 @@
 #error You should not include sub-header files
 #endif
 
-/*   (We will not use FIQs)  */
+/* FIQs are used only for the tick, with -D FIQ_TICK (see irq.c) */
 
 #define IRQ_BASE 0x2000B000
 
@@ -40,12 +40,35 @@ iomemdef(IRQ_BASIC_ENABLE, IRQ_BASE + 0x218);
 iomemdef(IRQ_DISABLE1, IRQ_BASE + 0x21C);
 iomemdef(IRQ_DISABLE2, IRQ_BASE + 0x220);
 iomemdef(IRQ_BASIC_DISABLE, IRQ_BASE + 0x224);
+iomemdef(IRQ_FIQ_CONTROL, IRQ_BASE + 0x20C);
+
+/* A single source can be routed to the FIQ (Broadcom manual p. 116):
+ * GPU lines from 0 to 63, then the ARM lines of the basic register. */
+#define IRQ_FIQ_ENABLE (1u << 7)
+#define FIQ_SOURCE_GPU(n) (n)
+#define FIQ_SOURCE_BASIC(n) (IRQ_1_LINES + IRQ_2_LINES + (n))
+
+/* Only bits 0-7 of IRQ_BASIC_PENDING are ARM interrupt lines. The others
+ * tell that IRQ_PENDING1 or IRQ_PENDING2 have asserted lines (bits 8
+ * and 9) or replicate some GPU lines (bits 10-20). */
+#define IRQ_BASIC_ARM_LINES_MASK 0xffu
+
+#ifndef HOST_SIM /* The host simulation has its own (see sim/host.h) */
+
+/* CPSR bits set by irq_disable() and irq_save(). With the tick on the FIQ
+ * they mask the FIQ as well: the FIQ handler releases jobs like an ISR,
+ * so the code protected from IRQs must be protected from it too. */
+#ifdef FIQ_TICK
+#define IRQ_CPSR_MASK "0xc0"
+#else
+#define IRQ_CPSR_MASK "0x80"
+#endif
 
 /* Enable IRQs globally */
 #define irq_enable() do { \
 	unsigned long temp; \
 	__asm__ __volatile__ ("mrs %0, cpsr\n\t" \
-	                      "bic %0, %0, #0x80\n\t" \
+	                      "bic %0, %0, #" IRQ_CPSR_MASK "\n\t" \
 	                      "msr cpsr_c, %0\n\t" \
 	                      : "=r" (temp) \
 	                      : : "memory"); \
@@ -55,14 +78,36 @@ iomemdef(IRQ_BASIC_DISABLE, IRQ_BASE + 0x224);
 #define irq_disable() do { \
 	unsigned long temp; \
 	__asm__ __volatile__ ("mrs %0, cpsr\n\t" \
-	                      "orr %0, %0, #0x80\n\t" \
+	                      "orr %0, %0, #" IRQ_CPSR_MASK "\n\t" \
 	                      "msr cpsr_c, %0\n\t" \
 	                      : "=r" (temp) \
 	                      : : "memory"); \
 } while (0)
 
+/* Disable IRQs saving their previous state in flags.
+ * Unlike irq_disable()/irq_enable(), a pair irq_save()/irq_restore()
+ * can be used where IRQs may be already disabled (e.g. inside an ISR). */
+#define irq_save(flags) do { \
+	unsigned long temp; \
+	__asm__ __volatile__ ("mrs %0, cpsr\n\t" \
+	                      "orr %1, %0, #" IRQ_CPSR_MASK "\n\t" \
+	                      "msr cpsr_c, %1\n\t" \
+	                      : "=r" (flags), "=r" (temp) \
+	                      : : "memory"); \
+} while (0)
+
+/* Restore IRQ state saved by irq_save() */
+#define irq_restore(flags) \
+	__asm__ __volatile__ ("msr cpsr_c, %0" : : "r" (flags) : "memory")
+
+/* Non-zero if IRQs were already disabled when irq_save() saved flags */
+#define irq_flags_disabled(flags) ((flags) & 0x80)
+
 /* We used CPSR_C register instead of CPSR because we are interested
  * in just the "control" part of CPSR, that is the 8 less significant
  * bits of the register.
- * As seen in startup.S, 0x80 is the bit related to IRQ disabling.
+ * As seen in startup.S, 0x80 is the bit related to IRQ disabling
+ * (0x40 to FIQ disabling).
  * Check page 2-24 of the ARM manual for further informations. */
+
+#endif /* HOST_SIM */
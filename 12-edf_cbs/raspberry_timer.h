@@ -41,6 +41,29 @@ iomemdef(TIMER_COUNTER, TIMER_BASE + 0x420); /* Free running counter (Not in rea
 
 #define TIMER_IRQ_LINE 0 /* This timer is wired to the IRQ BASIC line 0 */
 
+/* The System Timer (Broadcom manual p. 172) is a free running 64 bit
+ * counter at 1MHz with four compare registers: when the lower 32 bits of
+ * the counter match a compare register, the related bit of SYSTIMER_CS is
+ * set and its IRQ line is asserted until that bit is written with 1.
+ * Channels 0 and 2 are used by the GPU.
+ * QEMU emulates this timer but not the ARM timer, so the QEMU build
+ * ("make qemu") takes its tick from channel 1. */
+#define SYSTIMER_BASE 0x20003000
+iomemdef(SYSTIMER_CS, SYSTIMER_BASE + 0x00);  /* Control/Status */
+iomemdef(SYSTIMER_CLO, SYSTIMER_BASE + 0x04); /* Counter lower 32 bits */
+iomemdef(SYSTIMER_CHI, SYSTIMER_BASE + 0x08); /* Counter higher 32 bits */
+iomemdef(SYSTIMER_C1, SYSTIMER_BASE + 0x10);  /* Compare 1 */
+
+#define SYSTIMER_M1 (1u<<1) /* Match of channel 1 */
+#define SYSTIMER_IRQ_LINE 1 /* Channel 1 is wired to the GPU IRQ 1 line 1 */
+
+/* Non zero if the tick interrupt is asserted (even if IRQs are disabled) */
+#ifdef QEMU
+#define tick_pending() (iomem(SYSTIMER_CS) & SYSTIMER_M1)
+#else
+#define tick_pending() (iomem(TIMER_RAW_IRQ) & 1u)
+#endif
+
 /* This board uses a timer based on an ARM AP804 timer module (see Broadcom SoC page 196).
  * This module expects a clock source of 1MHz which it isn't present on the SoC. We use
  * a pre-divider in order to take the main peripheral clock source, the APB (Advanced
@@ -68,9 +91,25 @@ iomemdef(TIMER_COUNTER, TIMER_BASE + 0x420); /* Free running counter (Not in rea
  * set in the TIMER_LOAD register */
 #define TIMER_LOAD_VALUE ((unsigned long)(TIMER_FREQ / HZ)) /* Value to reload in the timer register */
 
+/* In tickless mode (compile with "make tickless") the timer is programmed
+ * for the next event, but never more than TICKLESS_MAX_TICKS ahead */
+#define TICKLESS_MAX_TICKS HZ
+
 /* Control register (page 197) */
 #define TIMER_CTLR_32BIT_COUNTER (1u<<1) /* Broadcom manual says this bit is for 23bit counter... That's not true! */
 #define TIMER_CTLR_PRESCALE_16 (1u<<2)
 #define TIMER_CTLR_PRESCALE_256 (2u<<2)
 #define TIMER_CTLR_IRQ_EN (1u<<5)
 #define TIMER_CTLR_EN (1u<<7)
+#define TIMER_CTLR_FREE_EN (1u<<9) /* Enable the free running counter */
+#define TIMER_CTLR_FREE_PRESCALE(d) ((u32)(d) << 16) /* Free running counter clock = apb_clock/(d+1) */
+
+/* Microseconds read from a free running counter, for measures shorter than
+ * a tick (see stats.c). init_ticks() sets the prescaler of the free running
+ * counter of the ARM timer to PRE_DIVIDER_VAL, so it counts at TIMER_FREQ.
+ * QEMU does not emulate it: the System Timer runs at 1MHz as well. */
+#ifdef QEMU
+#define read_free_counter() ((u32) iomem(SYSTIMER_CLO))
+#else
+#define read_free_counter() ((u32) iomem(TIMER_COUNTER))
+#endif
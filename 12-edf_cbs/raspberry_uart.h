@@ -38,11 +38,19 @@ iomemdef(UART_CR, UART_BASE + 0x30); /* Control Register */
 iomemdef(UART_ICR, UART_BASE + 0x44); /* Interupt Clear Register */
 iomemdef(UART_IBRD, UART_BASE + 0x24); /* Integer Baud rate divisor */
 iomemdef(UART_FBRD, UART_BASE + 0x28); /* Fractional Baud rate divisor */
+iomemdef(UART_IFLS, UART_BASE + 0x34); /* Interrupt FIFO Level Select Register */
 iomemdef(UART_IMSC, UART_BASE + 0x38); /* Interupt Mask Set Clear Register */
+iomemdef(UART_RIS, UART_BASE + 0x3c); /* Raw Interrupt Status Register */
+iomemdef(UART_MIS, UART_BASE + 0x40); /* Masked Interrupt Status Register */
+iomemdef(UART_DMACR, UART_BASE + 0x48); /* DMA Control Register */
+
+/* UART0 is wired to the GPU IRQ 57, that is line 25 of GPU IRQ 2 (page 113) */
+#define UART_IRQ_LINE 25
 
 /* FR register (page 181) */
 #define UART_FR_TXFE (1u<<7) /* 1 if Transmit Holding Register is empty */
 #define UART_FR_TXFF (1u<<5) /* 1 if transmission FIFO (if enabled) or the THR (if FIFO disabled) are full */
+#define UART_FR_RXFE (1u<<4) /* 1 if the reception FIFO (or the receive holding register) is empty */
 #define UART_FR_BUSY (1u<<3) /* 1 if currently sending or receiving data */
 
 /* LCRH register (page 184) */
@@ -56,6 +64,19 @@ iomemdef(UART_IMSC, UART_BASE + 0x38); /* Interupt Mask Set Clear Register */
 #define UART_CR_RTS (1u<<11) /* Request to send */
 #define UART_CR_UARTEN (1u) /* Enable UART globally */
 
+/* IFLS register (page 186): the TX interrupt is raised when the FIFO
+ * level goes below the selected threshold */
+#define UART_IFLS_TX_1_8 (0u) /* bits 2-0: TX FIFO becomes 1/8 full (2 bytes left) */
+#define UART_IFLS_RX_1_2 (2u<<3) /* bits 5-3: RX FIFO becomes 1/2 full */
+
+/* IMSC, RIS, MIS and ICR registers share the same layout (page 188-192) */
+#define UART_INT_RX (1u<<4) /* Receive interrupt */
+#define UART_INT_TX (1u<<5) /* Transmit interrupt */
+#define UART_INT_RT (1u<<6) /* Receive timeout interrupt */
+
+/* DMACR register (page 193) */
+#define UART_DMACR_TXDMAE (1u<<1) /* Request DMA transfers for the TX FIFO */
+
 
 
 /* MINI UART DEFINITIONS */
@@ -81,6 +102,7 @@ iomemdef(AUX_MU_BAUD_REG, AUX_BASE + 0x68); /* Mini Uart Baudrate */
 #define AUX_MU_LCR_DATA_SIZE_MASK (3u) /* 00 for 7bit/symbol, 11 for 8bit/symbol */
 
 /* AUX_MU_LSR_REG register (page 15) */
+#define AUX_MU_LSR_DATA_READY 1u /* 1 if the receive FIFO holds at least 1 byte */
 #define AUX_MU_LSR_TX_EMPTY (1u<<5) /* 1 if transmission FIFO can accept at least 1 byte */
 
 /* AUX_MU_CNTL register (page 16) */
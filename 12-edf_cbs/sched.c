@@ -23,121 +23,301 @@ volatile unsigned long trigger_schedule = 0; /* Need to call schedule */
 
 struct task *current; /* Current task on the CPU */
 
-void check_periodic_tasks(void)
+/* Release queue: all the valid tasks ordered by releasetime.
+ * The root of the heap is the next task to be released, so at every tick
+ * the scheduler looks only at the root: O(1) when nothing is due and
+ * O(k log n) when k tasks are released. */
+static struct task *release_nodes[MAX_NUM_TASKS];
+static struct task_heap release_queue;
+
+/* EDF ready queue: the dynamic priority tasks (EDF and CBS) with at least
+ * a released job, ordered by abs_deadline. The root is the task to run.
+ * Every update (release, completion, change of deadline) costs at most
+ * one sift up and one sift down along a path of the heap: with
+ * MAX_NUM_TASKS = 32 tasks the heap has 6 levels, so at most 5 swaps
+ * each. Picking the task is O(1). */
+static struct task *edf_nodes[MAX_NUM_TASKS];
+static struct task_heap edf_ready;
+
+/* Add a new valid task to the scheduler */
+void sched_add_task(struct task *t)
 {
-	unsigned long now = SYSTEM_TICKS;
-	struct task *f;
-	int i;
+	unsigned long flags;
+	
+	irq_save(flags); /* The queue is also used by isr_tick() */
+	if (heap_insert(&release_queue, t) != 0)
+		_panic(__FILE__, __LINE__, "Release queue is full.");
+	irq_restore(flags);
+}
+
+/* FPR ready queue: a FIFO list of released tasks for each priority level
+ * and a bitmap of the non-empty lists. The list of level l is marked by
+ * the bit 31 - l, so the highest priority level with a released job is
+ * the number of leading zeros of the bitmap: a single CLZ instruction.
+ * The queues are updated with IRQs disabled when a task goes from 0 to 1
+ * released jobs and when a job completes. */
+struct fpr_list {
+	struct task *head;
+	struct task *tail;
+};
+static struct fpr_list fpr_ready[FPR_LEVELS];
+static unsigned long fpr_bitmap;
+
+#define fpr_bit(level) (0x80000000u >> (level))
+
+/* Append a task to the list of its level */
+static void __hot_text fpr_enqueue(struct task *t)
+{
+	int level = fpr_level(t);
+	struct fpr_list *l = &fpr_ready[level];
+	
+	t->ready_next = NULL;
+	if (l->tail)
+		l->tail->ready_next = t;
+	else
+		l->head = t;
+	l->tail = t;
+	fpr_bitmap |= fpr_bit(level);
+}
+
+/* Remove a task from the list of its level.
+ * The task that completes a job is the head of its list, unless another
+ * task of the same level was released before it, so this is O(1) in the
+ * common case. */
+static void __hot_text fpr_dequeue(struct task *t)
+{
+	int level = fpr_level(t);
+	struct fpr_list *l = &fpr_ready[level];
+	struct task **p = &l->head, *prev = NULL;
 	
-	for (i=0, f=taskset+1 /* Defined in tasks.c */; i<active_tasks; ++f) {
-		
-		/* If f exceded taskset[MAX_NUM_TASKS] means that active_tasks
-		 * had a value greater than the real number of active tasks */
-		if (f - taskset > MAX_NUM_TASKS)
-			_panic(__FILE__, __LINE__, "More active tasks than total tasks! Value of active_tasks must be wrong.");
-		
-		/* This job is not active */
-		if (!f->valid)
-			continue;
-		
-		if (time_after_eq(now, f->releasetime)) {
-			f->releasetime += f->period; /* Update next release time */
-			if (f->budget) { /* CBS server */
-				f->budget = f->max_budget; /* Reload the budget */
-			}
-			else {
-				++f->released; /* f->released += 1; */
-				trigger_schedule = 1; /* Reschedule in order to check if this is a higher priority job */
-				++globalreleases; /* Update the number of all releases */
-			}
-		}
-		
-		++i;
+	while (*p != t) {
+		if (*p == NULL)
+			_panic(__FILE__, __LINE__, "Task not found in its FPR ready list.");
+		prev = *p;
+		p = &prev->ready_next;
 	}
+	*p = t->ready_next;
+	if (l->tail == t)
+		l->tail = prev;
+	if (l->head == NULL)
+		fpr_bitmap &= ~fpr_bit(level);
+}
+
+/* Highest priority FPR task with a released job or NULL: O(1) */
+static inline struct task *fpr_peek(void)
+{
+	if (fpr_bitmap == 0)
+		return NULL; /* __builtin_clz(0) is undefined */
+	return fpr_ready[__builtin_clz(fpr_bitmap)].head;
 }
 
-static inline struct task *select_best_task(void)
-{
-	unsigned long maxprio;
-	int i, edf = 0;
-	struct task *f, *best;
-	
-	maxprio = MAXUINT; /* Init to the least priority */
-	best = &taskset[0]; /* If no periodic task can be scheduled run the idle task */
-	for (i=0, f=taskset+1; i<active_tasks; ++f) {
-		
-		
-		/* If f exceded taskset[MAX_NUM_TASKS] means that active_tasks
-		 * had a value greater than the real number of active tasks */
-		if (f - taskset > MAX_NUM_TASKS)
-			_panic(__FILE__, __LINE__, "More active tasks than total tasks! Value of active_tasks must be wrong.");
-		
-		if (!f->valid)
-			continue;
-		
-		++i; /* This task is active */
-		
-		/* There are no job released at this time for this task */
-		if (f->released == 0)
-			continue;
-		
-		if (edf) {
-			if (f->rel_deadline == 0)
-				/* This is a fixed priority task, but dynamic tasks has higher priority */
-				continue;
-			if (time_before(f->priority, maxprio)) {
-				maxprio = f->abs_deadline;
-				best = f;
-			}
-		}
-		else {
-			/* No dynamic task found until now */
-			if (f->rel_deadline != 0) {
-				/* This is a dynamic task */
-				edf = 1;
-				maxprio = f->abs_deadline;
-				best = f;
-				continue;
-			}
-			if (f->priority < maxprio) {
-				maxprio = f->priority;
-				best = f;
-			}
-		}
+/* Called with IRQs disabled when t->released goes from 0 to 1 */
+void __hot_text sched_task_ready(struct task *t)
+{
+	if (t->rel_deadline == 0)
+		fpr_enqueue(t);
+	else if (heap_insert(&edf_ready, t) != 0)
+		_panic(__FILE__, __LINE__, "EDF ready queue is full.");
+}
+
+/* Called with IRQs disabled when the abs_deadline of a dynamic task changed */
+void __hot_text sched_deadline_changed(struct task *t)
+{
+	if (t->ready_pos >= 0) /* Not in the queue if it has no released jobs */
+		heap_update(&edf_ready, t);
+}
+
+/* Release a job of a periodic task (IRQs disabled) */
+void __hot_text release_job(struct task *f)
+{
+	if (f->budget) { /* CBS server */
+		f->budget = f->max_budget; /* Reload the budget */
+		return;
 	}
-	return best;
+	
+	++f->released; /* f->released += 1; */
+	trace(TRACE_RELEASE, f, f->released);
+	if (f->released == 1) {
+		sched_task_ready(f);
+		stats_release(f);
+	}
+	trigger_schedule = 1; /* Reschedule in order to check if this is a higher priority job */
+	++globalreleases; /* Update the number of all releases */
 }
 
-struct task *schedule(void)
+/* Called by task_entry_point() with IRQs disabled after a job of t completed,
+ * t->released has been decremented and the deadline of an EDF task has been
+ * moved to the next job */
+void __hot_text sched_job_done(struct task *t)
+{
+	if (t->rel_deadline == 0) {
+		/* Pending jobs of t go behind the other ready tasks of the same level */
+		fpr_dequeue(t);
+		if (t->released)
+			fpr_enqueue(t);
+	}
+	else if (t->released == 0)
+		heap_remove(&edf_ready, t);
+	else
+		heap_update(&edf_ready, t); /* Next job, next deadline */
+}
+
+/* Call release() for every task in q whose release time is not after now.
+ * This is separated from check_periodic_tasks() so that the benchmarks can
+ * run the same code on a bigger queue. */
+void __hot_text release_due_tasks(struct task_heap *q, unsigned long now, release_t release)
+{
+	struct task *f;
+	
+	/* If the root is not due, no other task is */
+	while ((f = heap_top(q)) != NULL && time_after_eq(now, f->releasetime)) {
+		f->releasetime += f->period; /* Update next release time */
+		heap_update(q, f); /* The root has now a later key: move it down */
+		release(f);
+	}
+	/* If a tick has been lost (or in tickless mode) a task may be released
+	 * more than once here: one job for each period elapsed. */
+}
+
+void __hot_text check_periodic_tasks(void)
+{
+	release_due_tasks(&release_queue, SYSTEM_TICKS, release_job);
+}
+
+/* Tick of the next release among all tasks, used by the tickless timer.
+ * If there are no tasks, the answer is "not before TICKLESS_MAX_TICKS". */
+unsigned long __hot_text next_release_time(void)
+{
+	struct task *f = heap_top(&release_queue);
+	unsigned long next = SYSTEM_TICKS + TICKLESS_MAX_TICKS;
+	
+	if (f != NULL && time_before(f->releasetime, next))
+		next = f->releasetime;
+	return next;
+}
+
+/* Highest priority task with a released job: O(1).
+ * Called with IRQs disabled. */
+struct task __hot_text *select_best_task(void)
+{
+	struct task *best;
+	
+	/* Dynamic tasks have higher priority than fixed priority ones */
+	best = heap_top(&edf_ready); /* Earliest deadline */
+	if (best)
+		return best;
+	
+	best = fpr_peek(); /* Highest priority fixed priority task */
+	if (best)
+		return best;
+	
+	return &taskset[0]; /* If no periodic task can be scheduled run the idle task */
+}
+
+/* Scheduler lock.
+ * While sched_lock_depth is not 0 schedule() does not change the running
+ * task. It is taken:
+ *   - by a task, with sched_lock()/sched_unlock(), to run a section of code
+ *     that must not be preempted by other tasks (IRQs are still served);
+ *   - by schedule() itself when it chooses a new task, and released by
+ *     irqhandler.S when _switch_to() has put the new task on the CPU. An
+ *     IRQ in between cannot switch task and make the choice of schedule()
+ *     stale.
+ * Releases that happen while the lock is taken leave trigger_schedule set,
+ * so the scheduler runs again as soon as possible.
+ * Not static: irqhandler.S releases it. */
+volatile unsigned long sched_lock_depth = 0;
+
+/* Initialize the queues of the scheduler: all of them are empty */
+void init_scheduler(void)
+{
+	int i;
+	
+	init_heap(&release_queue, release_nodes, MAX_NUM_TASKS,
+			offsetof(struct task, releasetime), offsetof(struct task, release_pos));
+	init_heap(&edf_ready, edf_nodes, MAX_NUM_TASKS,
+			offsetof(struct task, abs_deadline), offsetof(struct task, ready_pos));
+	for (i = 0; i < FPR_LEVELS; ++i)
+		fpr_ready[i].head = fpr_ready[i].tail = NULL;
+	fpr_bitmap = 0;
+	sched_lock_depth = 0;
+	trigger_schedule = 0;
+}
+
+void sched_lock(void)
+{
+	unsigned long flags;
+	
+	irq_save(flags);
+	++sched_lock_depth;
+	irq_restore(flags);
+}
+
+/* Must be called by a task (SYSTEM mode, IRQs enabled), not by an ISR */
+void sched_unlock(void)
+{
+	int pending;
+	
+	irq_disable();
+	--sched_lock_depth;
+	pending = (sched_lock_depth == 0 && trigger_schedule);
+	irq_enable();
+	
+	if (pending)
+		_sys_schedule(); /* Something has been released in the meantime */
+}
+
+/* Choose the task to run.
+ * Ready queues are updated when jobs are released or completed and when
+ * deadlines change, so this is just a peek of their heads with IRQs
+ * disabled: its latency does not depend on the number of tasks or on how
+ * many releases happen meanwhile. */
+struct task __hot_text *schedule(void)
 {
 	struct task *best;
-	unsigned long state;
-	static int do_not_enter = 0;
+	PROFILE_BEGIN(PROFILE_SCHEDULE);
 	
 	irq_disable();
-	if (do_not_enter != 0) {
+	if (sched_lock_depth != 0) {
 		irq_enable();
+		PROFILE_END(PROFILE_SCHEDULE);
 		return NULL;
 	}
 	
-	do_not_enter = 1;
-	
-	do {
-		state = globalreleases;
-		irq_enable();
-		best = select_best_task(); /* Get the highest priority job to execute */
-		irq_disable();
-	} while (state != globalreleases);
 	trigger_schedule = 0;
-	best = (best != current ? best : NULL);
-	
-	do_not_enter = 0;
+	best = select_best_task(); /* Get the highest priority job to execute */
+	if (best == current) {
+		best = NULL;
+	}
+	else {
+		stats_switch(current, best);
+		trace(TRACE_DISPATCH, best, current - taskset);
+		++sched_lock_depth; /* Released after _switch_to() */
+		tick_reprogram(best); /* Tickless mode: next event depends on the new task */
+		vfp_switch(best); /* The VFP registers are switched lazily */
+	}
 	irq_enable();
 	
+	PROFILE_END(PROFILE_SCHEDULE);
+	
 	/* Return NULL if the task to execute is that already on CPU */
 	return best;
 }
 
+#ifdef HOST_SIM
+
+/* The host simulation keeps a ucontext for each task (see sim/sim.c) */
+void _switch_to(struct task *to)
+{
+	struct task *from = current;
+	
+	--sched_lock_depth; /* Taken by schedule(), see irqhandler.S */
+	current = to;
+	sim_switch(from, to);
+}
+
+#else
+
 /* STMIA: Store Multiple Increment After.
  * Store in memory (at address regs) the block of registers r4-r11 one by one
  * and for each register stored, increment by 4 the address. */
@@ -167,8 +347,8 @@ struct task *schedule(void)
 /* Do a context change from the current task in execution to the new one (to).
  * __attribute__((naked)) specifies the compiler to generate assembly only for what
  * it is written and nothing else (such as initialization instruction or return instructions) */
-void _switch_to(struct task *to) __attribute__((naked));
-void _switch_to(struct task *to)
+void _switch_to(struct task *to) __naked;
+void __hot_text _switch_to(struct task *to)
 {
 	/* We know what task is on the CPU because is that pointed by current. */
 	irq_disable();
@@ -186,3 +366,5 @@ void _switch_to(struct task *to)
 /* It's important to check the assembly generated in order to determine if the
  * compiler used some registers _switch_to() is going to save. Registers r4 to
  * r11 should appear only within the stmia and ldmia instructions. */
+
+#endif /* HOST_SIM */
@@ -0,0 +1,241 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Console command shell.
+ * 
+ * shell_job() is the job of a periodic FPR task with the lowest priority
+ * (see entry.c): it runs only when no real-time job is ready, reads the
+ * bytes received by the console UART (getc(), filled by the RX interrupt)
+ * and executes a command for every line.
+ * 
+ * The output goes to the transmission ring of UART0 and a command starts
+ * only when the ring has at least SHELL_MIN_ROOM free bytes, so that
+ * putc() never has to wait for the UART (see uart.c).
+ * Long outputs are put off to the next jobs until there's room for them:
+ * "trace" sends a line of records at a time, "stats" waits for room for
+ * the whole dump (or for the empty ring, if the dump is larger: then the
+ * rest waits in putc(), delaying only the shell). */
+
+#define SHELL_LINE_MAX 64
+#define SHELL_MIN_ROOM 3072 /* Bytes, about the output of "tasks" with MAX_NUM_TASKS tasks */
+#define SHELL_TRACE_CHUNK 32 /* Records per "@trace" line (see trace.c) */
+
+static char shell_line[SHELL_LINE_MAX];
+static int shell_len;
+static int shell_last; /* Last byte received */
+static int shell_trace_left; /* Records still to send, -1 for all */
+static int shell_stats_pending; /* "stats" waits for room in the ring */
+
+struct shell_command {
+	const char *name;
+	const char *help;
+	void (*run)(const char *args);
+};
+
+static void shell_help(const char *args);
+
+static unsigned long shell_atou(const char *s)
+{
+	unsigned long v = 0;
+	
+	while (*s >= '0' && *s <= '9')
+		v = v * 10 + *s++ - '0';
+	return v;
+}
+
+static void shell_tasks(const char *args __attribute__((unused)))
+{
+	const struct task *t;
+	int i;
+	
+	for (i = 1; i < MAX_NUM_TASKS; ++i) { /* Task 0 is the idle task */
+		t = &taskset[i];
+		if (!t->valid)
+			continue;
+		kprintf("%2d %-12s period=%lu wcet=%lu ", i, t->name, t->period, t->wcet);
+		if (t->rel_deadline == 0)
+			kprintf("FPR prio=%lu", t->priority);
+		else if (is_cbs_server(t))
+			kprintf("CBS budget=%lu/%lu", t->budget, t->max_budget);
+		else
+			kprintf("EDF deadline=%lu", t->rel_deadline);
+		kprintf(" next=%lu pending=%lu\n", t->releasetime, t->released);
+	}
+	kprintf("releases=%lu tick=%lu\n", globalreleases, get_ticks());
+}
+
+static void shell_stats(const char *args __attribute__((unused)))
+{
+#ifdef TASK_STATS
+	shell_stats_pending = 1; /* See shell_continue() */
+#else
+	puts("Statistics are not collected, build with \"make stats\"\n");
+#endif
+}
+
+static void shell_profile(const char *args __attribute__((unused)))
+{
+#ifdef PROFILE
+	profile_dump();
+#else
+	puts("Profiling is disabled, build with \"make profile\"\n");
+#endif
+}
+
+/* Send the records of the trace not yet sent, at most n if given */
+static void shell_trace(const char *args)
+{
+	shell_trace_left = *args ? (int) shell_atou(args) : -1;
+}
+
+/* Send lines of records while there's room in the ring */
+static void shell_trace_continue(void)
+{
+	int n, sent;
+	
+	while (shell_trace_left != 0 && uart_tx_room() >= SHELL_MIN_ROOM) {
+		n = SHELL_TRACE_CHUNK;
+		if (shell_trace_left > 0 && n > shell_trace_left)
+			n = shell_trace_left;
+		sent = trace_flush(n); /* Decode it with tools/trace_decode.py */
+		if (shell_trace_left > 0)
+			shell_trace_left -= sent;
+		if (sent < n)
+			shell_trace_left = 0; /* Nothing else to send */
+	}
+}
+
+/* Go on with the output of the last command. Returns 0 when it's over */
+static int shell_continue(void)
+{
+	if (shell_trace_left != 0)
+		shell_trace_continue();
+#ifdef TASK_STATS
+	if (shell_stats_pending && (uart_tx_room() >= stats_dump_size() || uart_tx_idle())) {
+		stats_dump(); /* Decode it with tools/stats_decode.py */
+		shell_stats_pending = 0;
+	}
+#endif
+	return shell_trace_left != 0 || shell_stats_pending;
+}
+
+static void shell_timer(const char *args __attribute__((unused)))
+{
+	timer_dump();
+}
+
+static void shell_uart(const char *args __attribute__((unused)))
+{
+	kprintf("uart: tx_room=%lu tx_dropped=%lu rx_overruns=%lu\n",
+	        uart_tx_room(), uart_tx_dropped, uart_rx_overruns);
+	kprintf("klog: pending=%u lost=%u\n", klog_head - klog_tail, klog_lost);
+}
+
+static const struct shell_command shell_commands[] = {
+	{ "help",    "this list",                              shell_help },
+	{ "tasks",   "the task set and the state of each task", shell_tasks },
+	{ "stats",   "execution and response times",           shell_stats },
+	{ "profile", "cycles and cache misses of the kernel",   shell_profile },
+	{ "trace",   "[n] the trace records not yet sent",      shell_trace },
+	{ "timer",   "the state of the timer",                  shell_timer },
+	{ "uart",    "counters of the console and of the log",  shell_uart },
+};
+
+#define SHELL_COMMANDS ((int) (sizeof(shell_commands) / sizeof(shell_commands[0])))
+
+static void shell_help(const char *args __attribute__((unused)))
+{
+	int i;
+	
+	for (i = 0; i < SHELL_COMMANDS; ++i)
+		kprintf("%-8s %s\n", shell_commands[i].name, shell_commands[i].help);
+}
+
+/* If line begins with the word name return the arguments, else NULL */
+static const char *shell_match(const char *line, const char *name)
+{
+	while (*name && *line == *name) {
+		++line;
+		++name;
+	}
+	if (*name || (*line && *line != ' '))
+		return NULL;
+	while (*line == ' ')
+		++line;
+	return line;
+}
+
+static void shell_exec(const char *line)
+{
+	const char *args;
+	int i;
+	
+	while (*line == ' ')
+		++line;
+	if (!*line)
+		return;
+	for (i = 0; i < SHELL_COMMANDS; ++i) {
+		args = shell_match(line, shell_commands[i].name);
+		if (args) {
+			shell_commands[i].run(args);
+			return;
+		}
+	}
+	kprintf("%s: unknown command, try \"help\"\n", line);
+}
+
+void shell_job(void *arg __attribute__((unused)))
+{
+	int ch;
+	
+	if (shell_trace_left != 0 || shell_stats_pending) {
+		if (shell_continue())
+			return; /* Go on with the next job */
+		puts("> ");
+	}
+	
+	while (uart_tx_room() >= SHELL_MIN_ROOM && (ch = getc()) >= 0) {
+		if (ch == '\r' || ch == '\n') {
+			if (ch == '\n' && shell_last == '\r') { /* "\r\n" is a single end of line */
+				shell_last = ch;
+				continue;
+			}
+			shell_last = ch;
+			puts("\n");
+			shell_line[shell_len] = '\0';
+			shell_len = 0;
+			shell_exec(shell_line);
+			if (shell_continue())
+				return; /* The prompt comes at the end of the output */
+			puts("> ");
+			continue;
+		}
+		shell_last = ch;
+		if (ch == '\b' || ch == 0x7f) { /* Backspace or delete */
+			if (shell_len > 0) {
+				--shell_len;
+				puts("\b \b");
+			}
+		} else if (ch >= ' ' && ch < 0x7f && shell_len < SHELL_LINE_MAX - 1) {
+			shell_line[shell_len++] = ch;
+			putc(ch); /* Echo */
+		}
+	}
+}
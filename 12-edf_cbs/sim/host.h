@@ -0,0 +1,78 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RASPBERRY_H
+#error You should not include sub-header files
+#endif
+
+/* Host simulation build (see sim/sim.c).
+ * When HOST_SIM is defined raspberry.h includes this file instead of
+ * the target iomem() and raspberry_cpu.h, so the scheduler sources can be compiled for the host.
+ * Every CPU specific primitive they use is replaced by an equivalent that
+ * makes sense in a single threaded Linux process. */
+
+/* ~~~~~~~~ MEMORY BARRIER ~~~~~~~~ */
+
+/* There's no other master on the bus: a compiler barrier is enough */
+#define __synchronization_barrier() __asm__ __volatile__ ("":::"memory")
+#define __memory_barrier() __asm__ __volatile__ ("":::"memory")
+
+/* ~~~~~~~~~~~~~ IRQ ~~~~~~~~~~~~~~ */
+
+/* Interrupts are simulated by sim_tick() and they are never asynchronous,
+ * so these macros have nothing to do */
+#define irq_enable() do { } while (0)
+#define irq_disable() do { } while (0)
+#define irq_save(flags) do { (flags) = 0; } while (0)
+#define irq_restore(flags) do { (void)(flags); } while (0)
+#define irq_flags_disabled(flags) ((void)(flags), 1)
+
+/* ~~~~~~~~~~~~~ MMIO ~~~~~~~~~~~~~ */
+
+/* Peripheral registers (from 0x20000000 to 0x21000000) are plain memory */
+#define SIM_IOMEM_BASE (0x20000000u / sizeof(u32))
+#define SIM_IOMEM_SIZE (0x01000000u / sizeof(u32))
+extern volatile u32 sim_iomem[SIM_IOMEM_SIZE];
+#define iomem(N) sim_iomem[(N) - SIM_IOMEM_BASE]
+
+/* ~~~~~~~~ FUNCTIONS ~~~~~~~~ */
+
+/* The context switch is done by the simulator (see _switch_to() in sched.c)
+ * and the C compiler of the host does not accept naked functions */
+#define __naked
+
+/* ~~~~~~~~ PERFORMANCE MONITOR ~~~~~~~~ */
+
+/* The time stamp counter of the host replaces the cycle counter */
+#if defined(__x86_64__) || defined(__i386__)
+#define read_cycle_counter() ((u32)__builtin_ia32_rdtsc())
+#else
+#define read_cycle_counter() (0u)
+#endif
+#define CYCLE_COUNTER_HZ 1000000000u /* Not accurate, it depends on the host */
+#define read_pmn0() (0u)
+#define read_pmn1() (0u)
+
+/* ~~~~~~~~~~~~~ WFI ~~~~~~~~~~~~~~ */
+
+#define __wfi() do { } while (0)
+
+/* Hooks of the simulator */
+struct task;
+extern void sim_init_task_context(struct task *t, char *stack, unsigned long size);
+extern void sim_switch(struct task *from, struct task *to);
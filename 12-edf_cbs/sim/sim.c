@@ -0,0 +1,543 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host simulation of the scheduler.
+ * sched.c, tasks.c, cbs.c and heap.c are compiled for the host with
+ * HOST_SIM defined (see host.h). This file provides what the rest of the
+ * program provides on the Raspberry:
+ *   - sim_tick() does what isr_tick() and the preemption routine of
+ *     irqhandler.S do, but it is called synchronously: by the idle task
+ *     while it waits and by the jobs while they "execute";
+ *   - every task has a ucontext_t and _switch_to() swaps them;
+ *   - the console functions write on the standard output.
+ * Time is virtual: a job that needs C ticks calls sim_tick() C times, so
+ * the program runs as fast as the host can execute the scheduler.
+ * 
+ * Each run generates many random tasksets, simulates them for a number of
+ * ticks and checks that no job misses its deadline when the taskset is
+ * accepted by the admission test, then prints the cost of the scheduler
+ * per tick. */
+
+#include "raspberry.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+
+/* Defined in tasks.c and sched.c, called only by irqhandler.S on the Raspberry */
+extern void task_entry_point(struct task *t);
+extern void _switch_to(struct task *to);
+
+volatile unsigned long SYSTEM_TICKS = 0;
+volatile u32 sim_iomem[SIM_IOMEM_SIZE];
+
+/* ~~~~~~~~ CONSOLE ~~~~~~~~ */
+
+static int sim_console = 0; /* Print the messages of the kernel (-v) */
+
+static void print(const char *s)
+{
+	if (write(1, s, strlen(s)) < 0)
+		exit(2);
+}
+
+static void print_u(unsigned long long v)
+{
+	char buf[24], *p = buf + sizeof(buf);
+	
+	*--p = '\0';
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	print(p);
+}
+
+int putc(int c)
+{
+	char s[2] = { (char)c, '\0' };
+	
+	if (sim_console)
+		print(s);
+	return c;
+}
+
+int puts(const char *s)
+{
+	if (sim_console)
+		print(s);
+	return 0;
+}
+
+int putu(unsigned long v)
+{
+	if (sim_console)
+		print_u(v);
+	return 0;
+}
+
+int putd(long v)
+{
+	if (v < 0) {
+		putc('-');
+		v = -v;
+	}
+	return putu(v);
+}
+
+int puth(unsigned long v)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+	
+	puts("0x");
+	for (i = sizeof(v) * 8 - 4; i >= 0; i -= 4)
+		putc(digits[(v >> i) & 0xf]);
+	return 0;
+}
+
+void _panic(const char *file, int line, const char *msg)
+{
+	sim_console = 1;
+	puts("\n\nPANIC!\n");
+	puts(file);
+	puts(":");
+	putd(line);
+	puts(": ");
+	puts(msg);
+	puts("\n");
+	abort();
+}
+
+/* ~~~~~~~~ CONTEXTS ~~~~~~~~ */
+
+static ucontext_t sim_context[MAX_NUM_TASKS]; /* sim_context[0] is main() */
+
+static void sim_task_start(void)
+{
+	/* _switch_to() already set current to this task */
+	task_entry_point(current);
+}
+
+void sim_init_task_context(struct task *t, char *stack, unsigned long size)
+{
+	ucontext_t *uc = &sim_context[t - taskset];
+	
+	if (getcontext(uc) != 0)
+		_panic(__FILE__, __LINE__, "getcontext() failed.");
+	uc->uc_stack.ss_sp = stack;
+	uc->uc_stack.ss_size = size;
+	uc->uc_link = NULL; /* task_entry_point() never returns */
+	makecontext(uc, sim_task_start, 0);
+}
+
+void sim_switch(struct task *from, struct task *to)
+{
+	if (swapcontext(&sim_context[from - taskset], &sim_context[to - taskset]) != 0)
+		_panic(__FILE__, __LINE__, "swapcontext() failed.");
+}
+
+/* The task calls the scheduler because its job completed */
+void _sys_schedule(void)
+{
+	struct task *t = schedule();
+	
+	if (t)
+		_switch_to(t);
+}
+
+/* ~~~~~~~~ SIMULATION ~~~~~~~~ */
+
+enum sim_mode { SIM_EDF, SIM_FPR, SIM_CBS };
+
+/* Parameters (see usage()) */
+static enum sim_mode mode = SIM_EDF;
+static unsigned long num_sets = 1000;
+static int num_tasks = 10;
+static int util = -1;                   /* Percent. Default depends on the mode */
+static unsigned long set_ticks = 10000;
+static unsigned long min_period = 10, max_period = 1000;
+static unsigned long cbs_budget = 5, cbs_period = 50;
+static unsigned long ap_interarrival = 50, ap_max_exec = 10;
+static u32 seed = 1;
+
+/* A periodic task of the generated taskset */
+struct sim_task {
+	unsigned long period;
+	unsigned long wcet;
+	unsigned long deadline;             /* Absolute deadline of the next job */
+	unsigned long jobs;
+	unsigned long misses;
+};
+static struct sim_task sim_tasks[MAX_NUM_TASKS];
+
+/* State of the current taskset */
+static unsigned long sim_end;
+static int sim_done;
+static u32 rnd_state;
+
+/* Statistics of the whole run */
+static unsigned long long total_ticks, total_jobs, total_misses, total_switches;
+static unsigned long long total_ap_jobs;
+static unsigned long long tick_cycles, tick_cycles_max;
+static unsigned long long sched_calls, sched_cycles, sched_cycles_max;
+static unsigned long failed_sets, rejected_sets;
+
+/* xorshift32: the same seed always generates the same tasksets */
+static u32 rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static double rnd_double(void)
+{
+	return (rnd() >> 8) / 16777216.0; /* [0, 1) */
+}
+
+/* The simulation of the current taskset is over: go back to main() */
+static void sim_stop(void)
+{
+	struct task *from = current;
+	
+	sim_done = 1;
+	if (from != &taskset[0]) {
+		current = &taskset[0];
+		sim_switch(from, &taskset[0]);
+	}
+}
+
+/* One tick of the timer. It's like an IRQ taken by the current task.
+ * @job_done: the current job completes its last tick of execution. The
+ *            job ends before the IRQ and the tick cannot preempt it: the
+ *            scheduler runs in _sys_schedule() when the job returns. */
+static void sim_tick(int job_done)
+{
+	u32 start, c, s;
+	struct task *t = NULL;
+	
+	if (sim_done)
+		return;
+	
+	start = read_cycle_counter();
+	
+	/* What isr_tick() does */
+	SYSTEM_TICKS++;
+	if (current->budget) /* A CBS server is running */
+		decrease_cbs_budget(current);
+	check_periodic_tasks();
+	
+	/* Aperiodic requests are served by the CBS server */
+	if (mode == SIM_CBS && rnd() % ap_interarrival == 0)
+		activate_cbs_worker(&cbs0, 0);
+	
+	/* What the preemption routine of the IRQ handler does */
+	if (trigger_schedule && !job_done) {
+		s = read_cycle_counter();
+		t = schedule();
+		s = read_cycle_counter() - s;
+		sched_calls++;
+		sched_cycles += s;
+		if (s > sched_cycles_max)
+			sched_cycles_max = s;
+	}
+	
+	c = read_cycle_counter() - start;
+	tick_cycles += c;
+	if (c > tick_cycles_max)
+		tick_cycles_max = c;
+	
+	if (SYSTEM_TICKS == sim_end) {
+		sim_stop();
+		return;
+	}
+	
+	if (t) {
+		total_switches++;
+		_switch_to(t);
+	}
+}
+
+/* The current job runs for n ticks */
+static void sim_consume(unsigned long n)
+{
+	while (n--)
+		sim_tick(n == 0);
+}
+
+static void sim_periodic_job(void *arg)
+{
+	struct sim_task *s = (struct sim_task *)arg;
+	
+	sim_consume(s->wcet);
+	s->jobs++;
+	if (time_after(SYSTEM_TICKS, s->deadline))
+		s->misses++;
+	s->deadline += s->period;
+}
+
+static void sim_aperiodic_job(void *arg)
+{
+	(void)arg;
+	sim_consume(1 + rnd() % ap_max_exec);
+	total_ap_jobs++;
+}
+
+/* Generate the periodic tasks of a taskset with total utilization u.
+ * UUniFast gives the utilization of each task, the period is uniform
+ * in [min_period, max_period] and the WCET is rounded down (but it is at
+ * least 1 tick), so the real utilization is never greater than u unless
+ * some task has a WCET of 1. In this case the taskset is generated again. */
+#define MAX_GENERATION_ATTEMPTS 1000
+static void generate_taskset(int n, double u)
+{
+	double sum, next, real;
+	int i, attempts = 0;
+	
+	do {
+		if (++attempts > MAX_GENERATION_ATTEMPTS) {
+			print("sim: cannot generate a taskset with this utilization:"
+					" use longer periods or fewer tasks\n");
+			exit(2);
+		}
+		sum = u;
+		real = 0.0;
+		for (i = 0; i < n; ++i) {
+			if (i < n - 1) {
+				next = sum * pow(rnd_double(), 1.0 / (n - 1 - i));
+			}
+			else {
+				next = 0.0;
+			}
+			sim_tasks[i].period = min_period + rnd() % (max_period - min_period + 1);
+			sim_tasks[i].wcet = (unsigned long)((sum - next) * sim_tasks[i].period);
+			if (sim_tasks[i].wcet == 0)
+				sim_tasks[i].wcet = 1;
+			real += (double)sim_tasks[i].wcet / sim_tasks[i].period;
+			sum = next;
+		}
+	} while (real > u);
+}
+
+/* Rate Monotonic: the shorter the period, the higher the priority */
+static unsigned long rm_priority(int i, int n)
+{
+	unsigned long prio = 0;
+	int j;
+	
+	for (j = 0; j < n; ++j)
+		if (sim_tasks[j].period < sim_tasks[i].period ||
+				(sim_tasks[j].period == sim_tasks[i].period && j < i))
+			++prio;
+	return prio;
+}
+
+static void print_taskset(unsigned long set, int n)
+{
+	int i;
+	
+	print("sim: FAIL set=");
+	print_u(set);
+	print(" tasks:");
+	for (i = 0; i < n; ++i) {
+		print(" ");
+		print_u(sim_tasks[i].wcet);
+		print("/");
+		print_u(sim_tasks[i].period);
+		if (sim_tasks[i].misses) {
+			print("(misses=");
+			print_u(sim_tasks[i].misses);
+			print(")");
+		}
+	}
+	print("\n");
+}
+
+/* Simulate one taskset for set_ticks ticks */
+static void run_set(unsigned long set)
+{
+	unsigned long misses = 0;
+	double u = util / 100.0;
+	int i, wid, err;
+	
+	rnd_state = seed + set * 2654435761u;
+	if (rnd_state == 0)
+		rnd_state = 1;
+	
+	SYSTEM_TICKS = 0;
+	sim_end = set_ticks;
+	sim_done = 0;
+	init_taskset();
+	
+	if (mode == SIM_CBS) {
+		u -= (double)cbs_budget / cbs_period; /* Bandwidth of the server */
+		if (init_cbs(cbs_budget, cbs_period, &cbs0, "cbs0") < 0)
+			_panic(__FILE__, __LINE__, "Cannot create the CBS server.");
+		wid = add_cbs_worker(&cbs0, sim_aperiodic_job, NULL);
+		if (wid != 0)
+			_panic(__FILE__, __LINE__, "Cannot create the CBS worker.");
+	}
+	
+	generate_taskset(num_tasks, u);
+	for (i = 0; i < num_tasks; ++i) {
+		struct sim_task *s = &sim_tasks[i];
+		
+		/* All tasks are released at tick 1: the critical instant */
+		s->deadline = 1 + s->period;
+		s->jobs = s->misses = 0;
+		err = create_task(sim_periodic_job, s, s->period, s->wcet, 1,
+				mode == SIM_FPR ? rm_priority(i, num_tasks) : s->period,
+				mode == SIM_FPR ? FPR : EDF, "sim");
+		if (err == ETASK_UNSCHED) {
+			rejected_sets++; /* Not simulated: it might miss deadlines */
+			return;
+		}
+		if (err < 0)
+			_panic(__FILE__, __LINE__, "Cannot create a task.");
+	}
+	
+	/* This is the idle task: time goes on until the end of the simulation */
+	while (!sim_done)
+		sim_tick(0);
+	
+	for (i = 0; i < num_tasks; ++i) {
+		total_jobs += sim_tasks[i].jobs;
+		misses += sim_tasks[i].misses;
+	}
+	total_misses += misses;
+	total_ticks += set_ticks;
+	if (misses) {
+		failed_sets++;
+		print_taskset(set, num_tasks);
+	}
+}
+
+static void usage(const char *name)
+{
+	print("Usage: ");
+	print(name);
+	print(" [options]\n"
+		"  -m edf|fpr|cbs  scheduling policy of the periodic tasks (default edf)\n"
+		"                  cbs: EDF tasks plus a CBS server for aperiodic jobs\n"
+		"  -s N            number of tasksets (default 1000)\n"
+		"  -n N            periodic tasks per taskset (default 10)\n"
+		"  -u P            total utilization in percent, including the CBS server\n"
+		"                  (default 95, 69 for fpr: below the Liu & Layland bound)\n"
+		"  -t N            ticks simulated for each taskset (default 10000)\n"
+		"  -T MIN,MAX      range of the periods in ticks (default 10,1000)\n"
+		"  -c Q,P          budget and period of the CBS server (default 5,50)\n"
+		"  -a I,E          mean interarrival and max execution time of the\n"
+		"                  aperiodic jobs in ticks (default 50,10)\n"
+		"  -r SEED         seed of the generator (default 1)\n"
+		"  -v              print the messages of the kernel\n"
+		"Tasksets rejected by the admission test of create_task() are not\n"
+		"simulated. The exit status is 1 if a periodic job of an accepted taskset\n"
+		"missed its deadline.\n");
+	exit(2);
+}
+
+static void parse_pair(const char *arg, unsigned long *a, unsigned long *b, const char *name)
+{
+	char *end;
+	
+	*a = strtoul(arg, &end, 10);
+	if (*end != ',')
+		usage(name);
+	*b = strtoul(end + 1, &end, 10);
+	if (*end != '\0')
+		usage(name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec begin, end;
+	unsigned long long ns;
+	unsigned long set;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "m:s:n:u:t:T:c:a:r:v")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "edf"))
+				mode = SIM_EDF;
+			else if (!strcmp(optarg, "fpr"))
+				mode = SIM_FPR;
+			else if (!strcmp(optarg, "cbs"))
+				mode = SIM_CBS;
+			else
+				usage(argv[0]);
+			break;
+		case 's': num_sets = strtoul(optarg, NULL, 10); break;
+		case 'n': num_tasks = atoi(optarg); break;
+		case 'u': util = atoi(optarg); break;
+		case 't': set_ticks = strtoul(optarg, NULL, 10); break;
+		case 'T': parse_pair(optarg, &min_period, &max_period, argv[0]); break;
+		case 'c': parse_pair(optarg, &cbs_budget, &cbs_period, argv[0]); break;
+		case 'a': parse_pair(optarg, &ap_interarrival, &ap_max_exec, argv[0]); break;
+		case 'r': seed = strtoul(optarg, NULL, 10); break;
+		case 'v': sim_console = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (util < 0)
+		util = (mode == SIM_FPR ? 69 : 95);
+	/* Task 0 is the idle task and the CBS server needs a slot too */
+	if (num_tasks < 1 || num_tasks > MAX_NUM_TASKS - 2 || util > 100 ||
+			min_period < 1 || max_period < min_period || set_ticks < 1 ||
+			cbs_budget < 1 || cbs_period < cbs_budget || ap_interarrival < 1 ||
+			ap_max_exec < 1)
+		usage(argv[0]);
+	if (mode == SIM_CBS && util * cbs_period <= 100 * cbs_budget)
+		usage(argv[0]); /* No room for the periodic tasks */
+	
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (set = 0; set < num_sets; ++set)
+		run_set(set);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - begin.tv_sec) * 1000000000ull + end.tv_nsec - begin.tv_nsec;
+	if (ns == 0)
+		ns = 1;
+	
+	/* One line of key=value pairs, easy to parse */
+	print("sim: mode=");
+	print(mode == SIM_EDF ? "edf" : mode == SIM_FPR ? "fpr" : "cbs");
+	print(" sets="); print_u(num_sets);
+	print(" tasks="); print_u(num_tasks);
+	print(" util="); print_u(util);
+	print(" ticks="); print_u(total_ticks);
+	print(" ms="); print_u(ns / 1000000);
+	print(" ticks_per_s="); print_u(total_ticks * 1000000000ull / ns);
+	print(" jobs="); print_u(total_jobs);
+	print(" aperiodic_jobs="); print_u(total_ap_jobs);
+	print(" switches="); print_u(total_switches);
+	print(" misses="); print_u(total_misses);
+	print(" failed_sets="); print_u(failed_sets);
+	print(" rejected_sets="); print_u(rejected_sets);
+	print(" tick_cycles_avg="); print_u(tick_cycles / (total_ticks ? total_ticks : 1));
+	print(" tick_cycles_max="); print_u(tick_cycles_max);
+	print(" schedule_cycles_avg="); print_u(sched_cycles / (sched_calls ? sched_calls : 1));
+	print(" schedule_cycles_max="); print_u(sched_cycles_max);
+	print("\n");
+	
+	return failed_sets ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Execution time statistics of the tasks (compile with "make stats").
+ * Every job is timed with read_free_counter(), in microseconds:
+ *   - execution time: the time the job spent on the CPU, from its start
+ *     in task_entry_point() to its end, without the intervals in which
+ *     other tasks preempted it (schedule() calls stats_switch()). IRQs
+ *     served while the job runs are included;
+ *   - response time: from the release of the job to its end. The release
+ *     is timestamped in release_job() (or activate_cbs_worker()) when
+ *     the task has no other pending job; a job released while the
+ *     previous one was still running was released one period after it.
+ *     For a CBS server with pending jobs this is an approximation: the
+ *     arrival of the next aperiodic request is not recorded, so its
+ *     response time is measured from the end of the previous job.
+ * 
+ * For both of them the table keeps min, max, total and a histogram with
+ * logarithmic buckets: bucket 0 counts the measures of 0us, bucket b > 0
+ * those in [2^(b-1), 2^b) and the last bucket everything above.
+ * 
+ * stats_dump() prints the table as a single line
+ * 
+ *     @stats <hexadecimal bytes>
+ * 
+ * that tools/stats_decode.py decodes. The bytes are a compact binary
+ * record, all the numbers are little endian:
+ * 
+ *     u32 magic "TSTA", u8 version, u8 number of tasks, u8 buckets, u8 0
+ *     for each valid task:
+ *         u8 id, u8 length of the name, the name (not terminated)
+ *         u32 jobs
+ *         u32 exec min, exec avg, exec max
+ *         u32 resp min, resp avg, resp max
+ *         u32 exec histogram[buckets]
+ *         u32 resp histogram[buckets] */
+
+#ifdef TASK_STATS
+
+#define STATS_VERSION 1
+#define STATS_BUCKETS 24 /* The last one starts at 2^22us, about 4s */
+
+struct stats_measure {
+	u32 min;
+	u32 max;
+	unsigned long long total;
+	u32 hist[STATS_BUCKETS];
+};
+
+struct task_stats {
+	u32 jobs;
+	struct stats_measure exec;
+	struct stats_measure resp;
+	
+	/* State of the running job */
+	u32 release;    /* When the oldest pending job was released */
+	u32 run_since;  /* When the task went on the CPU */
+	u32 exec_acc;   /* Execution time of the job before its last preemption */
+};
+
+/* Indexed by task ID */
+static struct task_stats stats_table[MAX_NUM_TASKS];
+
+static inline int stats_bucket(u32 v)
+{
+	int b = v ? 32 - __builtin_clz(v) : 0;
+	
+	return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+static void stats_add(struct stats_measure *m, u32 v)
+{
+	if (v < m->min)
+		m->min = v;
+	if (v > m->max)
+		m->max = v;
+	m->total += v;
+	m->hist[stats_bucket(v)]++;
+}
+
+static void stats_measure_reset(struct stats_measure *m)
+{
+	int i;
+	
+	m->min = MAXUINT;
+	m->max = 0;
+	m->total = 0;
+	for (i = 0; i < STATS_BUCKETS; ++i)
+		m->hist[i] = 0;
+}
+
+/* Called with IRQs disabled when t gets a job and had none pending */
+void __hot_text stats_release(struct task *t)
+{
+	stats_table[t - taskset].release = read_free_counter();
+}
+
+/* Called by schedule() with IRQs disabled when it puts to on the CPU */
+void __hot_text stats_switch(struct task *from, struct task *to)
+{
+	u32 now = read_free_counter();
+	struct task_stats *s = &stats_table[from - taskset];
+	
+	s->exec_acc += now - s->run_since;
+	stats_table[to - taskset].run_since = now;
+}
+
+/* Called by task_entry_point() with IRQs disabled before a job starts */
+void stats_job_begin(struct task *t)
+{
+	struct task_stats *s = &stats_table[t - taskset];
+	
+	s->exec_acc = 0;
+	s->run_since = read_free_counter();
+}
+
+/* Called by task_entry_point() with IRQs disabled after a job ended,
+ * before t->released is decremented */
+void stats_job_end(struct task *t)
+{
+	struct task_stats *s = &stats_table[t - taskset];
+	u32 now = read_free_counter();
+	
+	s->jobs++;
+	stats_add(&s->exec, s->exec_acc + (now - s->run_since));
+	stats_add(&s->resp, now - s->release);
+	
+	if (t->released > 1) { /* The next job has already been released */
+		if (t->budget) /* CBS server: arrival unknown, see above */
+			s->release = now;
+		else
+			s->release += t->period * (TIMER_FREQ / HZ);
+	}
+}
+
+void stats_reset(void)
+{
+	struct task_stats *s;
+	unsigned long flags;
+	
+	irq_save(flags);
+	for (s = stats_table; s < stats_table + MAX_NUM_TASKS; ++s) {
+		s->jobs = 0;
+		stats_measure_reset(&s->exec);
+		stats_measure_reset(&s->resp);
+	}
+	irq_restore(flags);
+}
+
+static void stats_put_measure(const struct stats_measure *m, u32 jobs)
+{
+	unsigned long long avg = m->total;
+	
+	if (jobs)
+		udiv64(&avg, jobs);
+	put_hex_le(jobs ? m->min : 0, 4);
+	put_hex_le((u32) avg, 4);
+	put_hex_le(m->max, 4);
+}
+
+static void stats_put_hist(const struct stats_measure *m)
+{
+	int i;
+	
+	for (i = 0; i < STATS_BUCKETS; ++i)
+		put_hex_le(m->hist[i], 4);
+}
+
+/* Characters of the line of stats_dump() with the current task set,
+ * "\r\n" included: the shell waits for this room in the UART ring */
+unsigned long stats_dump_size(void)
+{
+	unsigned long bytes = 8; /* Header */
+	int i, len;
+	
+	for (i = 1; i < MAX_NUM_TASKS; ++i) {
+		if (!taskset[i].valid)
+			continue;
+		for (len = 0; taskset[i].name[len] && len < 255; ++len);
+		bytes += 2 + len + 4 + 2 * 3 * 4 + 2 * STATS_BUCKETS * 4;
+	}
+	return 7 + 2 * bytes + 2; /* "@stats ", two digits per byte, "\r\n" */
+}
+
+void stats_dump(void)
+{
+	static struct task_stats s; /* A copy is too big for a task stack */
+	unsigned long flags;
+	int i, n = 0;
+	
+	for (i = 1; i < MAX_NUM_TASKS; ++i) /* Task 0 is the idle task */
+		if (taskset[i].valid)
+			++n;
+	
+	puts("@stats ");
+	put_hex_le('T' | 'S' << 8 | 'T' << 16 | 'A' << 24, 4);
+	put_hex_le(STATS_VERSION, 1);
+	put_hex_le(n, 1);
+	put_hex_le(STATS_BUCKETS, 1);
+	put_hex_le(0, 1);
+	
+	for (i = 1; i < MAX_NUM_TASKS && n > 0; ++i) {
+		if (!taskset[i].valid)
+			continue;
+		--n;
+		
+		/* Take a consistent copy, printing is slow */
+		irq_save(flags);
+		s = stats_table[i];
+		irq_restore(flags);
+		
+		put_hex_name(i, taskset[i].name);
+		put_hex_le(s.jobs, 4);
+		stats_put_measure(&s.exec, s.jobs);
+		stats_put_measure(&s.resp, s.jobs);
+		stats_put_hist(&s.exec);
+		stats_put_hist(&s.resp);
+	}
+	puts("\n");
+}
+
+#endif /* TASK_STATS */
@@ -22,7 +22,11 @@
 struct task taskset[MAX_NUM_TASKS];
 int active_tasks; /* How many active tasks are there */
 
+#ifdef HOST_SIM
+#define STACK_SIZE 65536 /* The C library of the host needs more room */
+#else
 #define STACK_SIZE 4096 /* Each stack is a page long */
+#endif
 char stacks[MAX_NUM_TASKS * STACK_SIZE] /* Each task has its own stack */
 		__attribute__((aligned(STACK_SIZE))) /* Align this array in memory */
 		__attribute__((section(".bss.stack"))); /* Put this variable in a separate part of bss section */
@@ -46,9 +50,12 @@ void init_taskset(void)
 	current = &taskset[0];
 	/* Task 0 is considered the idle task or the kernel task and it is
 	 * executed every time no other task can run. */
+	
+	init_scheduler();
+	stats_reset();
 }
 
-void task_entry_point(struct task *t) __attribute__((naked));
+void task_entry_point(struct task *t) __naked;
 /* Handler for a periodic task
  * @t: the task to run
  */
@@ -61,15 +68,18 @@ void task_entry_point(struct task *t)
 			 * something wrong. */
 			_panic(__FILE__, __LINE__, "select_best_task() returned the wrong task to run.");
 		
+		stats_job_begin(t);
 		irq_enable();
 		t->job(t->arg); /* Run the job for this task */
 		irq_disable();
+		stats_job_end(t);
 		--t->released;
+		trace(TRACE_COMPLETE, t, t->released);
 		
 		/* If this is a EDF task, update its deadline */
 		if (t->rel_deadline != 0 && t->budget == 0) {
-			/* t->priority contains the absolute deadline of this job */
-			if (time_after(SYSTEM_TICKS, t->priority)) {
+			if (time_after(get_ticks(), t->abs_deadline)) {
+				trace(TRACE_DEADLINE_MISS, t, 0);
 				puts("Job of EDF task '");
 				puts(t->name);
 				puts("' missed its deadline!\n");
@@ -78,6 +88,7 @@ void task_entry_point(struct task *t)
 			 * hasn't been released yet) */
 			t->abs_deadline += t->period;
 		}
+		sched_job_done(t); /* Update the ready queues */
 		
 		/* This job ended its execution, so no other work can be done
 		 * by this task until its next release. Calling _sys_schedule() will
@@ -89,6 +100,8 @@ void task_entry_point(struct task *t)
 	}
 }
 
+#define TASK_INITIAL_CPSR 0x1ful /* SYSTEM mode, IRQ and FIQ enabled, ARM state */
+
 /* Initialize the stack for the specific task
  * @t: the pointer to the task for which the stack is going to be initialized
  * @ntask: the number of the task (between 0 and MAX_NUM_TASK - 1)
@@ -98,6 +111,12 @@ static void init_task_context(struct task *t, int ntask)
 	unsigned long *sp;
 	int i;
 	
+#ifdef HOST_SIM
+	/* The simulator does not use the stack frame below */
+	sim_init_task_context(t, (char *)stack0_top - (ntask + 1) * STACK_SIZE, STACK_SIZE);
+	return;
+#endif
+	
 	sp = (unsigned long *)(stack0_top - ntask * STACK_SIZE); /* Get the top of the stack for this task */
 	
 	/* Initialize the stack
@@ -137,7 +156,7 @@ static void init_task_context(struct task *t, int ntask)
 	 *         +---------------+ <-- mem_start (defined in sert.lds)
 	 * 
 	 */
-	*(--sp) = 0ul;                              /* spsr */
+	*(--sp) = TASK_INITIAL_CPSR;                /* spsr: restored by rfeia in irqhandler.S */
 	*(--sp) = (unsigned long) task_entry_point; /* Function to call when this task starts */
 	*(--sp) = 0ul;                              /* r14/lr */
 	*(--sp) = 0ul;                              /* r12 */
@@ -164,27 +183,51 @@ static void init_task_context(struct task *t, int ntask)
  * @job: the job to be released by this task
  * @arg: data of the function call
  * @period: time between two releases
+ * @wcet: worst case execution time of a job (ignored for CBS tasks:
+ *        a server never runs for more than its budget)
  * @delay: initial delay before the firse release (task phase)
  * @prio_dead: priority (for static priority task)
  *             or relative deadline (for dynamic priority task)
+ *             or maximum budget (for CBS task)
  * @type: task type
  * @name: name description for this task
  * 
- * Returns the ID of the task. On error returns -1.
+ * Returns the ID of the task. On error returns a negative value:
+ *   - ETASK_INVALID if period or wcet are 0, or if the relative deadline
+ *     of an EDF task is 0 or greater than its period;
+ *   - ETASK_NOSLOT if there are no free slots in the taskset;
+ *   - ETASK_UNSCHED if the new task would make the taskset not schedulable
+ *     (see admission.c).
+ * Must be called by a task, not by an ISR.
  */
-int create_task(job_t job, void *arg, unsigned long period,
+int create_task(job_t job, void *arg, unsigned long period, unsigned long wcet,
 		unsigned long delay, unsigned long prio_dead,
 		enum task_type type, const char *name)
 {
 	int i;
 	struct task *t;
 	
-	/* Find a free slot or return -1 */
+	/* A task with period 0 would be released forever in the same tick */
+	if (period == 0)
+		return ETASK_INVALID;
+	if (type == EDF && (prio_dead == 0 || prio_dead > period))
+		return ETASK_INVALID; /* Only constrained deadlines */
+	if (type == CBS ? prio_dead == 0 : wcet == 0)
+		return ETASK_INVALID;
+	
+	/* No other task can create a task until this one is valid:
+	 * the free slot and the taskset seen by admission_test() do not
+	 * change in the meantime */
+	sched_lock();
+	
+	/* Find a free slot */
 	for (i=1; i<MAX_NUM_TASKS; ++i) /* Task 0 is the idle task */
 		if (!taskset[i].valid)
 			break;
-	if (i == MAX_NUM_TASKS)
-		return -1;
+	if (i == MAX_NUM_TASKS) {
+		sched_unlock();
+		return ETASK_NOSLOT;
+	}
 	
 	/* Get the pointer to the structure */
 	t = taskset + i;
@@ -194,10 +237,10 @@ int create_task(job_t job, void *arg, unsigned long period,
 	t->arg = arg;
 	t->name = name;
 	t->period = period;
-	t->releasetime = SYSTEM_TICKS + delay;
+	t->wcet = wcet;
+	t->budget = 0;
+	t->releasetime = get_ticks() + delay;
 	if (type == EDF) {
-		if (prio_dead == 0)
-			return -1;
 		t->abs_deadline = prio_dead + t->releasetime; /* Priority is the absolute deadline */
 		t->rel_deadline = prio_dead; /* Relative deadline */
 	}
@@ -205,7 +248,7 @@ int create_task(job_t job, void *arg, unsigned long period,
 		t->abs_deadline = 0; /* Initial deadline set to 0 (no jobs are released yet) */
 		t->max_budget = prio_dead; /* Maximum budget for the server */
 		t->budget = prio_dead; /* Initial budget set to max */
-		
+		t->wcet = prio_dead;
 	}
 	else { /* FPR */
 		t->priority = prio_dead; /* Priority is a fixed value */
@@ -213,7 +256,14 @@ int create_task(job_t job, void *arg, unsigned long period,
 	}
 	/* If t->deadline == 0 then fixed priority task
 	 * if t->deadline != 0 then dynamic priority task */
+	
+	if (admission_test(t) != 0) {
+		sched_unlock();
+		return ETASK_UNSCHED;
+	}
+	
 	t->released = 0;
+	t->ready_pos = -1; /* Not ready until the first release */
 	++active_tasks;
 	init_task_context(t, i);
 	
@@ -225,6 +275,8 @@ int create_task(job_t job, void *arg, unsigned long period,
 	t->valid = 1;
 
 	irq_disable();
+	sched_add_task(t); /* From now on the task can be released */
+	tick_reprogram(current); /* Tickless mode: the first release may be the next event */
 	puts("Task \"");
 	puts(name);
 	puts("\" with id ");
@@ -232,5 +284,7 @@ int create_task(job_t job, void *arg, unsigned long period,
 	puts(" created.\n");
 	irq_enable();
 	
+	sched_unlock();
+	
 	return i;
 }
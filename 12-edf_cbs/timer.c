@@ -20,39 +20,273 @@
 
 volatile unsigned long SYSTEM_TICKS = 0;
 
+#if defined(QEMU) && defined(TICKLESS)
+#error The tickless mode needs the ARM timer, that QEMU does not emulate
+#endif
+
+#ifdef TICKLESS
+
+/* In tickless mode the timer does not expire every 1/HZ seconds, but
+ * just when something must happen: the release of a job, the exhaustion
+ * of the budget of the running CBS server or the end of a delay.
+ * 
+ * SYSTEM_TICKS is the tick during which the timer was programmed the last
+ * time and it is updated only when the timer is programmed again.
+ * tick_base is the value of the free running counter (1MHz, see
+ * read_free_counter()) at the beginning of that tick, so the current tick
+ * can always be computed from the counter (see get_ticks()). The timer is
+ * programmed to expire at the beginning of tick SYSTEM_TICKS + tick_armed:
+ * 
+ *     TIMER_LOAD = tick_base + tick_armed * TIMER_LOAD_VALUE - read_free_counter()
+ * 
+ * The microseconds spent between the read of the counter and the write of
+ * TIMER_LOAD just delay the interrupt a bit: time is measured on the
+ * counter, that never stops, so they are not lost. */
+static u32 tick_base;
+static unsigned long tick_armed = 1;
+
+/* Earliest tick requested by tick_wakeup() */
+static int tick_wakeup_pending;
+static unsigned long tick_wakeup_time;
+
+/* Microseconds elapsed since the beginning of tick SYSTEM_TICKS.
+ * Must be called with IRQs disabled. */
+static inline u32 tick_elapsed_us(void)
+{
+	return read_free_counter() - tick_base;
+}
+
+/* Current tick, without waiting for the timer interrupt */
+unsigned long get_ticks(void)
+{
+	unsigned long flags, t;
+	
+	irq_save(flags);
+	/* TIMER_LOAD_VALUE is a constant: no division helper is needed */
+	t = SYSTEM_TICKS + tick_elapsed_us() / TIMER_LOAD_VALUE;
+	irq_restore(flags);
+	return t;
+}
+
+/* Bring SYSTEM_TICKS up to date, do what the elapsed ticks require and
+ * program the timer for the next event.
+ * @running: the task that is going to run until the next event
+ * 
+ * Must be called with IRQs disabled. */
+void __hot_text tick_reprogram(struct task *running)
+{
+	unsigned long n;
+	long d, load;
+	
+	n = tick_elapsed_us() / TIMER_LOAD_VALUE;
+	if (n > 0) {
+		tick_base += n * TIMER_LOAD_VALUE;
+		SYSTEM_TICKS += n;
+		if (current->budget) /* The CBS server ran for n ticks */
+			while (n-- > 0)
+				decrease_cbs_budget(current);
+		check_periodic_tasks();
+	}
+	
+	/* How many ticks until the next event */
+	d = (long)(next_release_time() - SYSTEM_TICKS);
+	if (running->budget && (long) running->budget < d)
+		d = running->budget;
+	if (tick_wakeup_pending) {
+		if (time_after(tick_wakeup_time, SYSTEM_TICKS)) {
+			if ((long)(tick_wakeup_time - SYSTEM_TICKS) < d)
+				d = tick_wakeup_time - SYSTEM_TICKS;
+		}
+		else
+			tick_wakeup_pending = 0;
+	}
+	if (d > TICKLESS_MAX_TICKS)
+		d = TICKLESS_MAX_TICKS;
+	if (d < 1)
+		d = 1; /* A release is late: do it at next tick */
+	
+	/* tick_base was less than a tick ago, so load is greater than 0
+	 * unless the code above took more than d - 1 ticks */
+	load = (long)(tick_base + d * TIMER_LOAD_VALUE - read_free_counter());
+	if (load < 1)
+		load = 1;
+	iomem(TIMER_LOAD) = load;
+	iomem(TIMER_CLEAR) = 0xfffffffful; /* Expiration already accounted */
+	tick_armed = d;
+}
+
+/* Make sure that the timer expires not later than tick expire, used by
+ * delay functions that sleep until next interrupt. */
+void tick_wakeup(unsigned long expire)
+{
+	unsigned long flags;
+	
+	irq_save(flags);
+	if (!tick_wakeup_pending || time_before(expire, tick_wakeup_time)) {
+		tick_wakeup_time = expire;
+		tick_wakeup_pending = 1;
+	}
+	if (time_before(expire, SYSTEM_TICKS + tick_armed))
+		tick_reprogram(current);
+	irq_restore(flags);
+}
+
 /* High-level interrupt handler function for ARM timer */
-static void isr_tick(void)
+static void __hot_text isr_tick(void)
 {
+#ifdef BENCHMARK
+	bench_tick_stamp = read_cycle_counter(); /* End of the IRQ entry path */
+#endif
+	PROFILE_BEGIN(PROFILE_TICK);
+	
+	/* The ACK is sent by tick_reprogram() */
+	tick_reprogram(current);
+	
+	PROFILE_END(PROFILE_TICK);
+#ifdef BENCHMARK
+	bench_tick_end = read_cycle_counter();
+#endif
+}
+
+#else /* TICKLESS */
+
+/* High-level interrupt handler function for ARM timer */
+static void __hot_text isr_tick(void)
+{
+#ifdef BENCHMARK
+	bench_tick_stamp = read_cycle_counter(); /* End of the IRQ entry path */
+#endif
+	PROFILE_BEGIN(PROFILE_TICK);
+	
+#ifdef QEMU
+	/* The next match is one period after this one, so the tick does not
+	 * drift. If IRQs were disabled for more than a period the counter
+	 * is already beyond that: restart from now, some ticks are lost. */
+	iomem(SYSTIMER_C1) = iomem(SYSTIMER_C1) + TIMER_LOAD_VALUE;
+	if (time_after_eq(iomem(SYSTIMER_CLO), iomem(SYSTIMER_C1)))
+		iomem(SYSTIMER_C1) = iomem(SYSTIMER_CLO) + TIMER_LOAD_VALUE;
+	iomem(SYSTIMER_CS) = SYSTIMER_M1; /* ACK */
+#else
 	/* Send an ACK to the interrupt handler (every value should be ok) */
 	iomem(TIMER_CLEAR) = 0xfffffffful;
+#endif
 	SYSTEM_TICKS++;
 	
 	if (current->budget) /* A CBS server is running */
 		decrease_cbs_budget(current);
 	
 	check_periodic_tasks();
+	
+	PROFILE_END(PROFILE_TICK);
+#ifdef BENCHMARK
+	bench_tick_end = read_cycle_counter();
+#endif
+}
+
+#endif /* TICKLESS */
+
+#ifdef QEMU
+
+void init_ticks(void)
+{
+	irq_disable();
+	
+	/* Register isr_tick() function as IRQ handler for System Timer channel 1 */
+#ifdef FIQ_TICK
+	if (register_isr_fiq(FIQ_SOURCE_GPU(SYSTIMER_IRQ_LINE), isr_tick)) {
+#else
+	if (register_isr_irq1(SYSTIMER_IRQ_LINE, isr_tick)) {
+#endif
+		_panic(__FILE__, __LINE__, "Cannot register timer interrupt.");
+	}
+	
+	/* The System Timer already runs at 1MHz: the first tick is
+	 * TIMER_LOAD_VALUE microseconds from now */
+	iomem(SYSTIMER_C1) = iomem(SYSTIMER_CLO) + TIMER_LOAD_VALUE;
+	iomem(SYSTIMER_CS) = SYSTIMER_M1; /* Clear an old match */
+	
+	irq_enable();
 }
 
+#else /* QEMU */
+
 void init_ticks(void)
 {
 	irq_disable();
 	
-	/* Register isr_tick() function as IRQ handler for ARM timer */
+	/* Register isr_tick() function as IRQ handler for ARM timer
+	 * (or FIQ handler, see irq.c) */
+#ifdef FIQ_TICK
+	if (register_isr_fiq(FIQ_SOURCE_BASIC(TIMER_IRQ_LINE), isr_tick)) {
+#else
 	if (register_isr_irq_basic(TIMER_IRQ_LINE, isr_tick)) {
+#endif
 		_panic(__FILE__, __LINE__, "Cannot register timer interrupt.");
 	}
 	
 	/* Timer clock must be 1MHz as expected by SP804 ARM timer module. */
 	iomem(TIMER_PRE_DIVIDER) = PRE_DIVIDER_VAL;
 	
-	/* Now we want the timer to generate an interrupt at frequency of 1000Hz */
+	/* Now we want the timer to generate an interrupt at frequency of 1000Hz
+	 * (in tickless mode this is just the first interval, see tick_reprogram()) */
 	iomem(TIMER_LOAD) = TIMER_LOAD_VALUE;
 	
 	/* Enable timer and related interrupt line */
 	//iomem(TIMER_CONTROL) = TIMER_CTLR_IRQ_EN | TIMER_CTLR_EN;
 	iomem(TIMER_CONTROL) = TIMER_CTLR_32BIT_COUNTER
 						| TIMER_CTLR_IRQ_EN
-						| TIMER_CTLR_EN;
+						| TIMER_CTLR_EN
+						| TIMER_CTLR_FREE_EN /* 1MHz clock for read_free_counter() */
+						| TIMER_CTLR_FREE_PRESCALE(PRE_DIVIDER_VAL);
+#ifdef TICKLESS
+	tick_base = read_free_counter(); /* The first tick starts now */
+#endif
 	
 	irq_enable();
 }
+
+#endif /* QEMU */
+
+/* Print the state of the timer (command "timer" of the shell) */
+void timer_dump(void)
+{
+	unsigned long flags, ticks, next;
+	u32 free_us, cycles, hw;
+#ifdef TICKLESS
+	unsigned long armed, wakeup_time;
+	u32 base;
+	int wakeup_pending;
+#endif
+	
+	/* Take a consistent snapshot, then print it with IRQs enabled */
+	irq_save(flags);
+	ticks = get_ticks();
+	next = next_release_time();
+	free_us = read_free_counter();
+	cycles = read_cycle_counter();
+#ifdef QEMU
+	hw = iomem(SYSTIMER_C1); /* Compare value of the next tick */
+#else
+	hw = iomem(TIMER_VALUE); /* Microseconds to the next interrupt */
+#endif
+#ifdef TICKLESS
+	armed = tick_armed;
+	base = tick_base;
+	wakeup_pending = tick_wakeup_pending;
+	wakeup_time = tick_wakeup_time;
+#endif
+	irq_restore(flags);
+	
+#ifdef TICKLESS
+	kprintf("timer: tickless HZ=%u tick=%lu next_release=%lu\n", HZ, ticks, next);
+	kprintf("timer: armed=%lu base_us=%u wakeup=%s%lu\n",
+	        armed, base, wakeup_pending ? "" : "none/", wakeup_time);
+#else
+	kprintf("timer: periodic HZ=%u tick=%lu next_release=%lu\n", HZ, ticks, next);
+#endif
+#ifdef QEMU
+	kprintf("timer: systimer_c1=%u free_us=%u cycles=%u\n", hw, free_us, cycles);
+#else
+	kprintf("timer: value=%u free_us=%u cycles=%u\n", hw, free_us, cycles);
+#endif
+}
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# Raspberry Bare Metal
+# Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+# 
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Format the "@klog" lines printed by klog_flush() in the klog_binary build.
+
+The records contain only the address of the format string: it is read
+from the ELF file of the program (sert.elf), as the strings printed with
+%s. The input is a log of the serial console, or the serial device itself
+with -d. Every message is printed with its time in seconds.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from trace_decode import serial_lines
+
+MAGIC = b"KLOG"
+VERSION = 1
+KLOG_ARGS = 6   # common.h
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONVERSION = re.compile(r"%(.)")
+
+
+class Elf:
+    """Read the memory image of the sections of a 32 bit little endian ELF"""
+
+    def __init__(self, path):
+        data = open(path, "rb").read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError("%s is not a 32 bit little endian ELF file" % path)
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", data, 0x2e)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from(
+                "<IIIIII", data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, data[offset:offset + size]))
+
+    def string(self, addr):
+        for start, content in self.sections:
+            if start <= addr < start + len(content):
+                end = content.find(b"\0", addr - start)
+                if end < 0:
+                    end = len(content)
+                return content[addr - start:end].decode("ascii", "replace")
+        return None
+
+
+def format_message(elf, fmt_addr, args):
+    """The text of a message, as klog_format() in klog.c would print it"""
+    fmt = elf.string(fmt_addr)
+    if fmt is None:
+        return "<unknown format 0x%08x> %s" % (fmt_addr, " ".join("0x%x" % a for a in args))
+    args = list(args)
+
+    def conversion(match):
+        c = match.group(1)
+        if c == "%":
+            return "%"
+        v = args.pop(0) if args else 0
+        if c == "u":
+            return str(v)
+        if c == "d":
+            return str(v - (1 << 32) if v & 0x80000000 else v)
+        if c == "x":
+            return "%x" % v
+        if c == "c":
+            return chr(v & 0xff)
+        if c == "s":
+            s = elf.string(v)
+            return s if s is not None else "<0x%08x>" % v
+        return match.group(0)
+
+    return CONVERSION.sub(conversion, fmt)
+
+
+def decode_line(data):
+    """Return (clock_hz, lost messages, records) of a line"""
+    magic, version, nrec, _, hz, lost = struct.unpack_from("<4sBBHII", data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a version %d klog line" % VERSION)
+    size = 4 * (2 + KLOG_ARGS)
+    records = [struct.unpack_from("<II%dI" % KLOG_ARGS, data, 16 + size * i)
+               for i in range(nrec)]
+    return hz, lost, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="ELF file of the program (sert.elf)")
+    parser.add_argument("log", nargs="?", help="console log (default stdin)")
+    parser.add_argument("-d", "--device", help="read from this serial device instead")
+    parser.add_argument("-t", "--time", type=float, default=0,
+                        help="seconds to read from the device (default until Ctrl-C)")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    if args.device:
+        lines = serial_lines(args.device, args.time)
+    else:
+        lines = open(args.log, errors="replace") if args.log else sys.stdin
+
+    cycles = 0
+    raw = None
+    lost = 0
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("@klog "):
+            continue
+        try:
+            hz, line_lost, records = decode_line(bytes.fromhex(line[6:]))
+        except (ValueError, struct.error) as e:
+            print("skipping a line: %s" % e, file=sys.stderr)
+            continue
+        if line_lost != lost:
+            if line_lost > lost:
+                print("klog: %d messages lost" % (line_lost - lost))
+            lost = line_lost
+        for fmt_addr, time, *msg_args in records:
+            # The clock wraps at 2^32: assume that messages are less
+            # than a wrap apart
+            if raw is not None:
+                cycles += (time - raw) & 0xffffffff
+            raw = time
+            text = format_message(elf, fmt_addr, msg_args)
+            sys.stdout.write("[%12.6f] %s" % (cycles / hz, text))
+            if not text.endswith("\n"):
+                sys.stdout.write("\n")
+        sys.stdout.flush()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
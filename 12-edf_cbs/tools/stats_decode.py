@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+#
+# Raspberry Bare Metal
+# Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+# 
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Decode the "@stats" lines printed by stats_dump() (see stats.c).
+
+Reads a log of the serial console (a file or the standard input) and
+prints, for the last dump or for all of them with -a, the execution and
+response times of every task in microseconds and their histograms.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"TSTA"
+VERSION = 1
+
+
+def decode(data):
+    """Return a list of task records from the bytes of a dump"""
+    magic, version, ntasks, buckets, _ = struct.unpack_from("<4sBBBB", data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a version %d stats dump" % VERSION)
+    off = 8
+    tasks = []
+    for _ in range(ntasks):
+        tid, namelen = struct.unpack_from("<BB", data, off)
+        off += 2
+        name = data[off:off + namelen].decode("ascii", "replace")
+        off += namelen
+        jobs, emin, eavg, emax, rmin, ravg, rmax = struct.unpack_from("<7I", data, off)
+        off += 7 * 4
+        ehist = struct.unpack_from("<%dI" % buckets, data, off)
+        off += buckets * 4
+        rhist = struct.unpack_from("<%dI" % buckets, data, off)
+        off += buckets * 4
+        tasks.append({
+            "id": tid, "name": name, "jobs": jobs,
+            "exec": (emin, eavg, emax), "resp": (rmin, ravg, rmax),
+            "exec_hist": ehist, "resp_hist": rhist,
+        })
+    return tasks
+
+
+def bucket_range(b):
+    """Interval of microseconds counted by bucket b"""
+    if b <= 1:
+        return str(b)
+    return "%d-%d" % (1 << (b - 1), (1 << b) - 1)
+
+
+def print_hist(label, hist):
+    last = len(hist) - 1
+    parts = []
+    for b, count in enumerate(hist):
+        if count:
+            r = ">=%d" % (1 << (b - 1)) if b == last else bucket_range(b)
+            parts.append("%s:%d" % (r, count))
+    print("    %s histogram (us): %s" % (label, " ".join(parts) or "empty"))
+
+
+def print_dump(tasks):
+    print("%3s %-16s %8s %26s %26s" % ("id", "name", "jobs",
+                                      "exec min/avg/max (us)", "resp min/avg/max (us)"))
+    for t in tasks:
+        print("%3d %-16s %8d %26s %26s" % (t["id"], t["name"], t["jobs"],
+                                           "%d/%d/%d" % t["exec"], "%d/%d/%d" % t["resp"]))
+        if t["jobs"]:
+            print_hist("exec", t["exec_hist"])
+            print_hist("resp", t["resp_hist"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", help="console log (default stdin)")
+    parser.add_argument("-a", "--all", action="store_true", help="decode every dump, not only the last")
+    args = parser.parse_args()
+
+    f = open(args.log, errors="replace") if args.log else sys.stdin
+    dumps = []
+    for line in f:
+        line = line.strip()
+        if line.startswith("@stats "):
+            try:
+                dumps.append(decode(bytes.fromhex(line[7:])))
+            except (ValueError, struct.error) as e:
+                print("skipping a dump: %s" % e, file=sys.stderr)
+    if not dumps:
+        print("no @stats lines found", file=sys.stderr)
+        return 1
+    for i, tasks in enumerate(dumps if args.all else dumps[-1:]):
+        if i:
+            print()
+        print_dump(tasks)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+#
+# Raspberry Bare Metal
+# Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+# 
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Convert the "@trace" lines printed by trace_flush() to Chrome trace JSON.
+
+The input is a log of the serial console, or the serial device itself
+with -d (the program must be built with "make trace" to send the trace
+periodically). Open the output in chrome://tracing or ui.perfetto.dev:
+every task is a thread with a slice for each interval it spent on the
+CPU, releases, completions, budget exhaustions and deadline misses are
+instant events, IRQs are slices of the "IRQ" thread.
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+import termios
+import time
+
+MAGIC = b"TRCE"
+VERSION = 1
+
+# enum trace_event in common.h
+RELEASE, DISPATCH, COMPLETE, BUDGET_EXHAUSTED, DEADLINE_MISS, IRQ_ENTRY, IRQ_EXIT = range(7)
+
+PID = 1
+IRQ_TID = 1000
+
+
+def decode_line(data):
+    """Return (clock_hz, first record number, names, records) of a line"""
+    magic, version, nrec, nnames, _, hz, first = struct.unpack_from("<4sBBBBII", data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a version %d trace line" % VERSION)
+    off = 16
+    names = {}
+    for _ in range(nnames):
+        tid, length = struct.unpack_from("<BB", data, off)
+        off += 2
+        names[tid] = data[off:off + length].decode("ascii", "replace")
+        off += length
+    records = [struct.unpack_from("<IBBH", data, off + 8 * i) for i in range(nrec)]
+    return hz, first, names, records
+
+
+class Converter:
+    def __init__(self):
+        self.events = []
+        self.names = {}
+        self.next_record = None
+        self.raw = None
+        self.cycles = 0
+        self.hz = 1
+        self.running = None     # (task, start in cycles)
+        self.irqs = []          # Nested IRQs being served
+        self.lost = 0
+
+    def us(self, cycles=None):
+        return (self.cycles if cycles is None else cycles) * 1e6 / self.hz
+
+    def instant(self, name, tid, scope="t", args=None):
+        e = {"name": name, "ph": "i", "s": scope, "pid": PID, "tid": tid, "ts": self.us()}
+        if args:
+            e["args"] = args
+        self.events.append(e)
+
+    def end_running(self):
+        if self.running is not None:
+            task, start = self.running
+            self.events.append({"name": self.names.get(task, "task %d" % task), "ph": "X",
+                                "pid": PID, "tid": task, "ts": self.us(start),
+                                "dur": self.us() - self.us(start)})
+            self.running = None
+
+    def end_irqs(self):
+        while self.irqs:
+            self.irqs.pop()
+            self.events.append({"ph": "E", "pid": PID, "tid": IRQ_TID, "ts": self.us()})
+
+    def line(self, hz, first, names, records):
+        self.hz = hz
+        self.names.update(names)
+        if self.next_record is not None and first != self.next_record:
+            # Records lost, or the board was reset. The clock keeps counting
+            # across lost records, so their time stays in the timeline
+            # (unless it wrapped in the meantime); after a reset it restarts
+            self.end_running()
+            self.end_irqs()
+            if first > self.next_record:
+                self.lost += first - self.next_record
+                self.instant("lost %d records" % (first - self.next_record), 0, "g")
+            else:
+                self.instant("restart", 0, "g")
+                self.raw = None
+        self.next_record = first + len(records)
+
+        for raw, event, task, arg in records:
+            # The clock wraps at 2^32: the trace has at least a tick per
+            # second, much more often than that
+            if self.raw is not None:
+                self.cycles += (raw - self.raw) & 0xffffffff
+            self.raw = raw
+
+            if event == DISPATCH:
+                self.end_running()
+                self.running = (task, self.cycles)
+            elif event == RELEASE:
+                self.instant("release", task, args={"pending": arg})
+            elif event == COMPLETE:
+                self.instant("complete", task, args={"pending": arg})
+            elif event == BUDGET_EXHAUSTED:
+                self.instant("budget exhausted", task)
+            elif event == DEADLINE_MISS:
+                self.instant("deadline miss", task, "p")
+            elif event == IRQ_ENTRY:
+                self.irqs.append(arg)
+                self.events.append({"name": "IRQ %d" % arg, "ph": "B", "pid": PID,
+                                    "tid": IRQ_TID, "ts": self.us(),
+                                    "args": {"task": self.names.get(task, task)}})
+            elif event == IRQ_EXIT:
+                if self.irqs:
+                    self.irqs.pop()
+                    self.events.append({"ph": "E", "pid": PID, "tid": IRQ_TID, "ts": self.us()})
+
+    def json(self):
+        self.end_running()
+        self.end_irqs()
+        meta = [{"name": "process_name", "ph": "M", "pid": PID, "args": {"name": "sert"}},
+                {"name": "thread_name", "ph": "M", "pid": PID, "tid": IRQ_TID,
+                 "args": {"name": "IRQ"}}]
+        for tid, name in sorted(self.names.items()):
+            meta.append({"name": "thread_name", "ph": "M", "pid": PID, "tid": tid,
+                         "args": {"name": "%d %s" % (tid, name)}})
+            meta.append({"name": "thread_sort_index", "ph": "M", "pid": PID, "tid": tid,
+                         "args": {"sort_index": tid}})
+        return {"traceEvents": meta + self.events, "displayTimeUnit": "ns"}
+
+
+def serial_lines(device, duration):
+    """Lines read from a serial device at 115200 8N1 (as uart.c sets it)"""
+    fd = os.open(device, os.O_RDONLY | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = termios.IGNPAR                                        # iflag
+    attr[1] = 0                                                     # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL          # cflag
+    attr[3] = 0                                                     # lflag: raw
+    attr[4] = attr[5] = termios.B115200
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 5                                      # 0.5s timeout
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    end = time.time() + duration if duration else None
+    buf = b""
+    try:
+        while end is None or time.time() < end:
+            buf += os.read(fd, 4096)
+            *lines, buf = buf.split(b"\n")
+            for line in lines:
+                yield line.decode("ascii", "replace")
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", help="console log (default stdin)")
+    parser.add_argument("-d", "--device", help="read from this serial device instead")
+    parser.add_argument("-t", "--time", type=float, default=0,
+                        help="seconds to read from the device (default until Ctrl-C)")
+    parser.add_argument("-o", "--output", help="JSON file (default stdout)")
+    args = parser.parse_args()
+
+    if args.device:
+        lines = serial_lines(args.device, args.time)
+    else:
+        lines = open(args.log, errors="replace") if args.log else sys.stdin
+
+    conv = Converter()
+    count = 0
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("@trace "):
+            continue
+        try:
+            conv.line(*decode_line(bytes.fromhex(line[7:])))
+        except (ValueError, struct.error) as e:
+            print("skipping a line: %s" % e, file=sys.stderr)
+            continue
+        count += 1
+    if count == 0:
+        print("no @trace lines found", file=sys.stderr)
+        return 1
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump(conv.json(), out)
+    out.write("\n")
+    if conv.lost:
+        print("%d records were lost" % conv.lost, file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
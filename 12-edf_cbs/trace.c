@@ -0,0 +1,130 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Scheduler trace.
+ * trace() (see common.h) appends a record of 8 bytes to trace_ring for
+ * each event: releases, dispatches, completions, CBS budget exhaustions,
+ * deadline misses and IRQ entries/exits. The entry and exit of an ISR
+ * that records no other event are not kept (see trace_irq_exit()):
+ * most IRQs are ticks releasing no job. trace() is called with IRQs
+ * already disabled, so it is just a read of the cycle counter, four
+ * stores and the increment of trace_head: the trace is always enabled.
+ * 
+ * The ring keeps the last TRACE_RECORDS events. trace_head counts all the
+ * events ever recorded, so the record number n is in trace_ring[n % TRACE_RECORDS]
+ * until it is overwritten by the record number n + TRACE_RECORDS.
+ * 
+ * trace_flush() sends the records not yet sent on the serial line, as
+ * lines
+ * 
+ *     @trace <hexadecimal bytes>
+ * 
+ * that tools/trace_decode.py converts to the JSON format of the Chrome
+ * trace viewer (chrome://tracing, ui.perfetto.dev). The bytes are a
+ * little endian binary record:
+ * 
+ *     u32 magic "TRCE", u8 version, u8 number of records, u8 number of
+ *     task names, u8 0
+ *     u32 frequency of the clock of the timestamps in Hz
+ *     u32 number of the first record (the decoder finds the lost ones)
+ *     for each task name: u8 id, u8 length of the name, the name
+ *     the records: u32 time, u8 event, u8 task, u16 arg
+ * 
+ * The task names are sent with the first line of each flush. */
+
+struct trace_record trace_ring[TRACE_RECORDS];
+volatile u32 trace_head = 0;
+static u32 trace_tail = 0; /* Next record to send */
+
+#define TRACE_VERSION 1
+#define TRACE_LINE_RECORDS 32
+
+/* Names of the idle task and of the first tasks - 1 valid tasks */
+static void trace_put_names(int tasks)
+{
+	int i;
+	
+	for (i = 0; i < MAX_NUM_TASKS && tasks > 0; ++i) {
+		if (i != 0 && !taskset[i].valid)
+			continue;
+		put_hex_name(i, i ? taskset[i].name : "idle");
+		--tasks;
+	}
+}
+
+/* Send at most max_records records (or all of them if max_records is 0)
+ * on the serial line. Records overwritten before being sent are lost:
+ * the decoder sees a gap in the numbers.
+ * Must be called by a task. Returns the number of records sent. */
+int trace_flush(int max_records)
+{
+	static struct trace_record line[TRACE_LINE_RECORDS]; /* Only a flush at a time */
+	unsigned long flags;
+	int sent = 0, n, i, tasks, names = 1;
+	u32 first, head;
+	
+	for (;;) {
+		/* Copy a line of records with IRQs disabled: the ring
+		 * does not move while copying */
+		irq_save(flags);
+		head = trace_head;
+		if (head - trace_tail > TRACE_RECORDS)
+			trace_tail = head - TRACE_RECORDS; /* Overwritten */
+		n = head - trace_tail;
+		if (n > TRACE_LINE_RECORDS)
+			n = TRACE_LINE_RECORDS;
+		if (max_records && n > max_records - sent)
+			n = max_records - sent;
+		first = trace_tail;
+		for (i = 0; i < n; ++i)
+			line[i] = trace_ring[(first + i) & (TRACE_RECORDS - 1)];
+		trace_tail += n;
+		irq_restore(flags);
+		
+		if (n == 0)
+			break;
+		
+		puts("@trace ");
+		put_hex_le('T' | 'R' << 8 | 'C' << 16 | 'E' << 24, 4);
+		put_hex_le(TRACE_VERSION, 1);
+		put_hex_le(n, 1);
+		tasks = 0;
+		if (names)
+			for (i = 0; i < MAX_NUM_TASKS; ++i) /* Idle task and valid tasks */
+				if (i == 0 || taskset[i].valid)
+					++tasks;
+		put_hex_le(tasks, 1);
+		put_hex_le(0, 1);
+		put_hex_le(CYCLE_COUNTER_HZ, 4);
+		put_hex_le(first, 4);
+		if (names)
+			trace_put_names(tasks);
+		names = 0;
+		for (i = 0; i < n; ++i) {
+			put_hex_le(line[i].time, 4);
+			put_hex_le(line[i].event, 1);
+			put_hex_le(line[i].task, 1);
+			put_hex_le(line[i].arg, 2);
+		}
+		puts("\n");
+		sent += n;
+	}
+	return sent;
+}
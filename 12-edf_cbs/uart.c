@@ -108,9 +108,37 @@ void init_miniuart(void)
 	loop_delay(100u);
 }
 
-int putc_uart0(int ch)
+/* Transmission ring buffer of UART0.
+ * 
+ * At 115200 baud a byte takes about 87us on the wire, so waiting for the
+ * FIFO to accept every character would stall the caller (often a task, or
+ * create_task() with IRQs disabled) for the whole transmission.
+ * putc_uart0() just appends the character here and the TX interrupt moves
+ * the buffer to the hardware FIFO (16 bytes) while the tasks run.
+ * 
+ * The size must be a power of 2: head and tail are free running counters
+ * and the position in the buffer is taken with a mask. */
+#define UART_TX_RING_SIZE 4096u
+#define UART_TX_RING_MASK (UART_TX_RING_SIZE - 1)
+
+static char uart_tx_ring[UART_TX_RING_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+static volatile unsigned long uart_tx_head; /* Next byte written by putc_uart0() */
+static volatile unsigned long uart_tx_tail; /* Next byte sent to the FIFO */
+
+/* Set by init_uart_irq(): until then (and after uart_sync()) every
+ * character is written to (and read from) the FIFO by polling, as before */
+static int uart_tx_irq;
+
+/* What putc_uart0() does when the ring is full */
+static enum uart_tx_policy uart_tx_policy = UART_TX_WAIT;
+
+/* Characters discarded with the UART_TX_DROP policy */
+volatile unsigned long uart_tx_dropped;
+
+/* Write a byte in the FIFO as soon as it has room: the only way to send
+ * before init_uart_irq() and with interrupts disabled */
+int putc_uart0_polled(int ch)
 {
-	/* UART0 */
 	//while(!(iomem(UART_FR) & UART_FR_TXFE)); /* Wait until FIFO becomes empty */
 	while(iomem(UART_FR) & UART_FR_TXFF); /* Wait until FIFO becomes not full */
 	iomem(UART_DR) = ch & 0xff;
@@ -118,6 +146,358 @@ int putc_uart0(int ch)
 	return 1;
 }
 
+#ifdef UART_DMA
+
+/* The ring is sent by a DMA channel instead of the TX interrupt: the
+ * channel copies to UART_DR one byte at a time, paced by the DREQ of the
+ * PL011, so the CPU is involved once per transfer and not every 14 bytes.
+ * A transfer takes at most UART_DMA_BLOCK bytes of the ring, and stops at
+ * its end (the next transfer starts again from the beginning). Bytes leave
+ * the ring (uart_tx_tail) only when the transfer completes, so that
+ * putc_uart0() doesn't overwrite them: with a full ring and IRQs disabled
+ * by the caller uart_tx_wait() spins until then, so a transfer must be
+ * short. */
+#define UART_DMA_CHANNEL 5 /* Not used by the firmware (see dma_init_channel()) */
+
+#define UART_DMA_TI (DMA_TI_SRC_INC | DMA_TI_DEST_DREQ | DMA_TI_WAIT_RESP | \
+                     DMA_TI_PERMAP(DMA_PERMAP_UART_TX))
+
+#define UART_DMA_BLOCK 64 /* Bytes per transfer: about 5.6 ms at 115200 baud */
+
+static struct dma_cb uart_dma_cb;
+static unsigned long uart_dma_len; /* Bytes of the running transfer, 0 if idle */
+
+/* Set up a control block that sends len bytes of the ring from pos */
+static void uart_dma_block(struct dma_cb *cb, unsigned long pos, unsigned long len)
+{
+	cb->ti = UART_DMA_TI;
+	cb->source_ad = DMA_BUS_RAM(uart_tx_ring + pos);
+	cb->dest_ad = DMA_BUS_PERIPH(UART_DR * sizeof(u32));
+	cb->txfr_len = len;
+	cb->stride = 0;
+	cb->nextconbk = 0;
+	
+	dcache_clean_range(uart_tx_ring + pos, len);
+}
+
+/* Start a transfer of the ring, if there's something to send and the
+ * channel is idle. Must be called with IRQs disabled. */
+static void uart_tx_start(void)
+{
+	unsigned long n = uart_tx_head - uart_tx_tail;
+	unsigned long pos = uart_tx_tail & UART_TX_RING_MASK;
+	unsigned long first = UART_TX_RING_SIZE - pos; /* Bytes before the wrap */
+	
+	if (uart_dma_len != 0 || n == 0)
+		return;
+	
+	if (n > first)
+		n = first;
+	if (n > UART_DMA_BLOCK)
+		n = UART_DMA_BLOCK;
+	uart_dma_block(&uart_dma_cb, pos, n);
+	uart_dma_cb.ti |= DMA_TI_INTEN;
+	dcache_clean_range(&uart_dma_cb, sizeof(uart_dma_cb));
+	
+	uart_dma_len = n;
+	dma_start(UART_DMA_CHANNEL, &uart_dma_cb);
+}
+
+/* The running transfer is over: free its bytes and send the next ones.
+ * Must be called with IRQs disabled and the channel not active. */
+static void uart_tx_done(void)
+{
+	if (dma_ack(UART_DMA_CHANNEL))
+		uart_tx_dropped += uart_dma_len; /* Bus error: these bytes are lost */
+	uart_tx_tail += uart_dma_len;
+	uart_dma_len = 0;
+	uart_tx_start();
+}
+
+/* Interrupt handler of the DMA channel */
+static void isr_uart_dma(void)
+{
+	/* Clear the interrupt first: a transfer that ends after this point
+	 * raises it again */
+	dma_clear_int(UART_DMA_CHANNEL);
+	
+	/* uart_tx_wait() may have already completed this transfer and
+	 * started the next one, that must keep running */
+	if (uart_dma_len != 0 && !dma_active(UART_DMA_CHANNEL))
+		uart_tx_done();
+}
+
+/* Make room in the full ring without the interrupt (IRQs disabled):
+ * wait for the end of the running transfer, at most UART_DMA_BLOCK bytes */
+static void uart_tx_wait(void)
+{
+	while (dma_active(UART_DMA_CHANNEL));
+	uart_tx_done();
+}
+
+#define uart_tx_kick() uart_tx_start()
+
+#else /* UART_DMA */
+
+/* Move bytes from the ring to the hardware FIFO until one of them is
+ * full (empty). The TX interrupt is left enabled only while the ring
+ * still has data: in this case the FIFO is full and the PL011 raises
+ * the interrupt when its level drops below the IFLS threshold.
+ * Must be called with IRQs disabled. */
+static void uart_tx_fill(void)
+{
+	while (uart_tx_tail != uart_tx_head && !(iomem(UART_FR) & UART_FR_TXFF))
+		iomem(UART_DR) = uart_tx_ring[uart_tx_tail++ & UART_TX_RING_MASK];
+	
+	if (uart_tx_tail != uart_tx_head)
+		iomem_high(UART_IMSC, UART_INT_TX);
+	else
+		iomem_low(UART_IMSC, UART_INT_TX);
+}
+
+/* Make room in the full ring without the interrupt (IRQs disabled):
+ * send the oldest byte by polling */
+static void uart_tx_wait(void)
+{
+	putc_uart0_polled(uart_tx_ring[uart_tx_tail++ & UART_TX_RING_MASK]);
+}
+
+/* If the interrupt is disabled the transmission is idle and must
+ * be started here, otherwise isr_uart() will get to the new bytes */
+#define uart_tx_kick() do { \
+	if (!(iomem(UART_IMSC) & UART_INT_TX)) \
+		uart_tx_fill(); \
+} while (0)
+
+#endif /* UART_DMA */
+
+/* Reception ring buffer of UART0.
+ * 
+ * isr_uart() moves the received bytes from the hardware FIFO to this
+ * ring, getc_uart0() takes them. There's a single producer (the ISR)
+ * that writes only uart_rx_head and a single consumer (a task) that
+ * writes only uart_rx_tail, so no lock is needed: a byte is written
+ * before head moves on, and read before tail moves on.
+ * When the ring is full the new bytes are dropped and counted. */
+#define UART_RX_RING_SIZE 256u /* Power of 2, as UART_TX_RING_SIZE */
+#define UART_RX_RING_MASK (UART_RX_RING_SIZE - 1)
+
+static char uart_rx_ring[UART_RX_RING_SIZE];
+static volatile unsigned long uart_rx_head; /* Next byte written by isr_uart() */
+static volatile unsigned long uart_rx_tail; /* Next byte read by getc_uart0() */
+
+/* Bytes received with a full ring */
+volatile unsigned long uart_rx_overruns;
+
+static void uart_rx_drain(void)
+{
+	unsigned long head = uart_rx_head;
+	
+	while (!(iomem(UART_FR) & UART_FR_RXFE)) {
+		char ch = iomem(UART_DR) & 0xff; /* Bits 8-11 are the error flags */
+		
+		if (head - uart_rx_tail == UART_RX_RING_SIZE) {
+			uart_rx_overruns++;
+			continue;
+		}
+		uart_rx_ring[head & UART_RX_RING_MASK] = ch;
+		__memory_barrier(); /* The byte is in the ring before head moves on */
+		uart_rx_head = ++head;
+	}
+}
+
+/* Interrupt handler of UART0.
+ * The RX interrupt is raised when the FIFO is half full, the RX timeout
+ * interrupt when a byte has been waiting in the FIFO for 32 bit periods:
+ * a single key typed on the console uses the second one. */
+static void isr_uart(void)
+{
+	u32 mis = iomem(UART_MIS);
+	
+	if (mis & (UART_INT_RX | UART_INT_RT)) {
+		uart_rx_drain(); /* Reading the FIFO clears both */
+		iomem(UART_ICR) = UART_INT_RX | UART_INT_RT;
+	}
+#ifndef UART_DMA
+	if (mis & UART_INT_TX) {
+		iomem(UART_ICR) = UART_INT_TX; /* Clear the interrupt */
+		uart_tx_fill();
+	}
+#endif
+}
+
+/* Next received byte, or -1 if there's none. Doesn't wait. */
+int getc_uart0(void)
+{
+	unsigned long tail = uart_rx_tail;
+	int ch;
+	
+	if (!uart_tx_irq) /* Polled mode: read the FIFO */
+		return (iomem(UART_FR) & UART_FR_RXFE) ? -1 : (int) (iomem(UART_DR) & 0xff);
+	
+	if (tail == uart_rx_head)
+		return -1;
+	ch = (unsigned char) uart_rx_ring[tail & UART_RX_RING_MASK];
+	__memory_barrier(); /* The byte is read before tail moves on */
+	uart_rx_tail = tail + 1;
+	return ch;
+}
+
+/* Append a byte to the ring. Must be called with IRQs disabled by
+ * irq_save(*flags). Returns 0 if the byte was dropped. */
+static int uart_tx_put(int ch, unsigned long *flags)
+{
+	while (uart_tx_head - uart_tx_tail == UART_TX_RING_SIZE) {
+		if (uart_tx_policy == UART_TX_DROP) {
+			uart_tx_dropped++;
+			return 0;
+		}
+		/* UART_TX_WAIT. If the caller had IRQs enabled, let them in
+		 * while the interrupt makes room: a full ring must not keep
+		 * them disabled for byte times. Otherwise make room without
+		 * the interrupt. */
+		if (irq_flags_disabled(*flags)) {
+			uart_tx_wait();
+		} else {
+			uart_tx_kick();
+			irq_restore(*flags);
+			irq_save(*flags);
+		}
+	}
+	
+	uart_tx_ring[uart_tx_head++ & UART_TX_RING_MASK] = ch;
+	return 1;
+}
+
+int putc_uart0(int ch)
+{
+	unsigned long flags;
+	int v;
+	
+	/* UART0 */
+	if (!uart_tx_irq)
+		return putc_uart0_polled(ch);
+	
+	irq_save(flags);
+	v = uart_tx_put(ch, &flags);
+	uart_tx_kick();
+	irq_restore(flags);
+	
+	return v;
+}
+
+/* puts() for UART0 with the ring: the string is copied with IRQs disabled
+ * UART_PUTS_CHUNK bytes at a time and the transmission is started once
+ * per chunk, instead of once per byte. If the ring fills up, IRQs are
+ * enabled again while waiting (see uart_tx_put()). */
+#define UART_PUTS_CHUNK 32
+
+static int uart0_puts(const char *st)
+{
+	unsigned long flags;
+	int v = 0, n;
+	
+	while (*st) {
+		irq_save(flags);
+		for (n = 0; *st && n < UART_PUTS_CHUNK; ++n) {
+			v += uart_tx_put(*st, &flags);
+			if (*st++ == '\n')
+				v += uart_tx_put('\r', &flags);
+		}
+		uart_tx_kick();
+		irq_restore(flags); /* Let pending interrupts in */
+	}
+	
+	return v;
+}
+
+/* Start sending UART0 output and receiving its input in background:
+ * call it after init_irq() */
+void init_uart_irq(void)
+{
+	unsigned long flags;
+	
+	irq_save(flags);
+	
+#ifdef UART_DMA
+	dma_init_channel(UART_DMA_CHANNEL);
+	iomem(UART_DMACR) = UART_DMACR_TXDMAE; /* Assert DREQ while the TX FIFO has room */
+	
+	if (register_isr_irq1(DMA_IRQ_LINE(UART_DMA_CHANNEL), isr_uart_dma)) {
+		_panic(__FILE__, __LINE__, "Cannot register DMA interrupt.");
+	}
+#endif
+	
+	/* Refill the FIFO when only 2 bytes are left: 14 bytes per interrupt
+	 * and still about 170us to serve it before the line goes idle */
+	iomem(UART_IFLS) = UART_IFLS_TX_1_8 | UART_IFLS_RX_1_2;
+	iomem(UART_ICR) = UART_INT_TX | UART_INT_RX | UART_INT_RT;
+	
+	if (register_isr_irq2(UART_IRQ_LINE, isr_uart)) {
+		_panic(__FILE__, __LINE__, "Cannot register UART interrupt.");
+	}
+	
+	/* Bytes already in the FIFO raise the interrupt as soon as IRQs
+	 * are enabled again */
+	iomem_high(UART_IMSC, UART_INT_RX | UART_INT_RT);
+	
+	uart_tx_irq = 1;
+	
+	irq_restore(flags);
+}
+
+/* Set what putc() does when the transmission ring is full and return
+ * the previous policy.
+ * UART_TX_WAIT (default): wait until the oldest bytes are sent, nothing
+ *                         is lost but the caller may be delayed.
+ * UART_TX_DROP: discard the character and count it in uart_tx_dropped. */
+enum uart_tx_policy uart_set_tx_policy(enum uart_tx_policy policy)
+{
+	enum uart_tx_policy old = uart_tx_policy;
+	uart_tx_policy = policy;
+	return old;
+}
+
+/* Free bytes in the transmission ring: a task can print that much
+ * without waiting (see shell.c) */
+unsigned long uart_tx_room(void)
+{
+	return UART_TX_RING_SIZE - (uart_tx_head - uart_tx_tail);
+}
+
+/* Non-zero when all the output has left the UART (used by bench.c) */
+int uart_tx_idle(void)
+{
+	return uart_tx_tail == uart_tx_head &&
+	       (iomem(UART_FR) & (UART_FR_TXFE | UART_FR_BUSY)) == UART_FR_TXFE;
+}
+
+/* Send all the buffered bytes without interrupts and go back to polled
+ * mode. Used by _panic(), which runs with IRQs disabled and never returns. */
+void uart_sync(void)
+{
+	unsigned long flags;
+	
+	irq_save(flags);
+	
+#ifndef UART_DMA
+	iomem_low(UART_IMSC, UART_INT_TX);
+#endif
+	while (uart_tx_tail != uart_tx_head)
+		uart_tx_wait();
+	uart_tx_irq = 0;
+	
+	irq_restore(flags);
+}
+
+int getc_uart1(void)
+{
+	/* UART1 has no interrupt handler, read the FIFO */
+	if (!(iomem(AUX_MU_LSR_REG) & AUX_MU_LSR_DATA_READY))
+		return -1;
+	return iomem(AUX_MU_IO_REG) & 0xff;
+}
+
 int putc_uart1(int ch)
 {
 	/* UART1 */
@@ -133,9 +513,31 @@ int putc_uart1(int ch)
 #define putc(ch)	putc_uart0(ch)
 #endif
 
+/* The other files call putc() as a function (declared in common.h).
+ * The parentheses around the name prevent the expansion of the macro. */
+int (putc)(int ch)
+{
+	return putc(ch);
+}
+
+/* Next byte received by the console UART, or -1 if there's none */
+int getc(void)
+{
+#ifdef MINI_UART
+	return getc_uart1();
+#else
+	return getc_uart0();
+#endif
+}
+
 int puts(const char *st)
 {
 	int v = 0;
+	
+#ifndef MINI_UART
+	if (uart_tx_irq)
+		return uart0_puts(st);
+#endif
 	while (*st) { /* Until st doesn't point to a \0 character */
 		v+= putc(*st);
 		if(*st++ == '\n')
@@ -150,59 +552,63 @@ int puts(const char *st)
 
 int puth(unsigned long v) /* Write a number in hexadecimal notation */
 {
-	/* Consider groups of 4bits */
-	int i, d, w = 0;
-	u32 mask;
+	/* "0x", 8 digits (one for every group of 4 bits) and '\0' */
+	char buf[2 + FMT_HEX_DIGITS + 1];
 	
-	puts("0x");
+	buf[0] = '0';
+	buf[1] = 'x';
+	buf[sizeof(buf) - 1] = '\0';
+	fmt_hex(buf + sizeof(buf) - 1, v, FMT_HEX_DIGITS); /* Fills buf from buf + 2 */
 	
-	/* We must write from the most significant value, because we reads in this way */
-	mask = 0xf0000000;
-	for (i = 0; mask != 0; i += 4, mask >>= 4) {
-		d = (v & mask) >> (28-i); /* This is a 32bit number, but we are interested in just 4 bits and we need to shift them to the least significant bits */
-		w += putc(d + (d > 9 ? 'a' - 10 : '0' ));
-	}
-	
-	return w;
+	return puts(buf);
 }
 
 int putu(unsigned long v)
 {
-	/* Dividing every time by 10 we can read digit per digit, but we need a buffer in order to accumulate discovered
-	 * digits that will be printed in inverse order */
-	
-	/* A 32bit number can contains up to 10 digits, considering the trailing line we need an 11 positions length buffer */
-	char buf[11];
-	int i, r;
-	if (v < 10) {
-		return putc(v + '0');
-	}
-	i = 10;
-	buf[i] = '\0';
-	while (v != 0) {
-		unsigned long w = v / 10;
-		r = v - w * 10; /* Reminder of the division (modulus is more expensive because it requires more divisions) */
-		buf[--i] = (char) (r + '0');
-		v = w;
-	}
+	/* The digits are found from the least significant one, so they are
+	 * written backward in a buffer that is printed at once (see format.c) */
+	char buf[FMT_DEC_DIGITS + 1];
 	
-	return puts(buf + i);
-	/* Start printing from the last written position, we don't know if the buffer is entirely full */
+	buf[FMT_DEC_DIGITS] = '\0';
+	return puts(fmt_dec(buf + FMT_DEC_DIGITS, v));
 }
 
 /* Signed numbers */
 int putd(long v)
 {
-	int w = 0;
-	if (v < 0) {
-		w += putc('-');
-		v = -v;
-	}
-	w += putu(v);
-	return w;
+	char buf[1 + FMT_DEC_DIGITS + 1]; /* With the sign */
+	char *p;
+	
+	buf[sizeof(buf) - 1] = '\0';
+	p = fmt_dec(buf + sizeof(buf) - 1, v < 0 ? 0u - (u32) v : (u32) v);
+	if (v < 0)
+		*--p = '-';
+	return puts(p);
+}
+
+/* Q16.16 fixed point numbers (v / 65536) with prec decimal digits,
+ * rounded to the nearest */
+int putq16(long v, int prec)
+{
+	char buf[FMT_FIXED_DIGITS + 1];
+	
+	buf[FMT_FIXED_DIGITS] = '\0';
+	return puts(fmt_q16(buf + FMT_FIXED_DIGITS, v, prec));
+}
+
+/* Millionths, e.g. a time in microseconds printed in seconds */
+int putmicro(long v)
+{
+	char buf[FMT_FIXED_DIGITS + 1];
+	
+	buf[FMT_FIXED_DIGITS] = '\0';
+	return puts(fmt_micro(buf + FMT_FIXED_DIGITS, v));
 }
 
-/* Floating point numbers */
+/* Floating point numbers.
+ * This uses the VFP, whose registers are switched lazily between tasks
+ * (see vfp.c) but not saved by the interrupt handler: in ISRs use putq16()
+ * or putmicro() */
 int putf(double v, int prec /* How many decimal digits to print */)
 {
 	int i, w = 0;
@@ -0,0 +1,91 @@
+/*
+ * Raspberry Bare Metal
+ * Copyright (C) 2014-2015 Federico "MrModd" Cosentino (http://mrmodd.it/)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raspberry.h"
+
+/* Lazy switch of the VFP registers.
+ * 
+ * _switch_to() saves just r4-r11: saving also d0-d15 and FPSCR at every
+ * context switch would cost 33 more words of memory traffic, while most
+ * tasks never use floating point numbers. Instead the VFP registers
+ * belong to a task, vfp_owner, and stay in the VFP until another task
+ * needs them:
+ *   - schedule() leaves the VFP enabled only if the chosen task is the
+ *     owner (see vfp_switch() in common.h);
+ *   - with the VFP disabled, the first VFP instruction of any other task
+ *     raises an Undefined Instruction exception. _bsp_undef() saves the
+ *     registers in the struct task of the owner, loads those of the
+ *     current task and enables the VFP; the instruction is then executed
+ *     again.
+ * So integer-only tasks pay just the write of FPEXC in schedule().
+ * The ISRs must not use the VFP: they would change the registers of the
+ * owner, or trap on behalf of the interrupted task (see putf() in uart.c). */
+
+struct task *vfp_owner; /* Task whose registers are in the VFP */
+
+/* VSTMIA/VLDMIA: store/load the double registers d0-d15 one by one at
+ * address ctx->d, incrementing the address after each one.
+ * The kernel does not use the VFP, so loading its registers does not
+ * change anything the compiler knows about. */
+#define save_vfp(ctx) \
+		__asm__ __volatile__("vstmia %1, {d0-d15}\n\t" \
+		                     "fmrx %0, fpscr" \
+		: "=r" ((ctx)->fpscr) : "r" ((ctx)->d) : "memory")
+
+#define load_vfp(ctx) \
+		__asm__ __volatile__("vldmia %0, {d0-d15}\n\t" \
+		                     "fmxr fpscr, %1" \
+		: : "r" ((ctx)->d), "r" ((ctx)->fpscr) : "memory")
+
+/* VFP instructions are the coprocessor instructions (CDP, MCR, MRC, LDC,
+ * STC, MCRR, MRRC) of coprocessors 10 and 11 */
+static inline int is_vfp_instruction(u32 insn)
+{
+	if ((insn >> 28) == 0xf)
+		return 0; /* Unconditional instructions are not */
+	if (((insn >> 24) & 0xf) != 0xe && ((insn >> 25) & 0x7) != 0x6)
+		return 0; /* Not a coprocessor instruction */
+	return ((insn >> 8) & 0xe) == 0xa;
+}
+
+/* Mid-level Undefined Instruction handler, called by _undef_handler (see
+ * irqhandler.S) with IRQs disabled.
+ * @pc: address of the undefined instruction */
+void _bsp_undef(const u32 *pc)
+{
+	/* Before init_taskset() the boot code runs as task 0 as well */
+	struct task *t = current ? current : &taskset[0];
+	
+	irq_disable(); /* The FIQ as well */
+	
+	if (!is_vfp_instruction(*pc))
+		_panic(__FILE__, __LINE__, "Undefined instruction.");
+	
+	/* With the VFP already enabled, this is an exception of the VFP
+	 * itself (e.g. an operation that needs the support code) */
+	if (read_fpexc() & FPEXC_EN)
+		_panic(__FILE__, __LINE__, "Unsupported VFP exception.");
+	
+	enable_vfp();
+	if (vfp_owner != t) {
+		if (vfp_owner)
+			save_vfp(&vfp_owner->vfp);
+		load_vfp(&t->vfp);
+		vfp_owner = t;
+	}
+}